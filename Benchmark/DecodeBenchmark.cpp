@@ -0,0 +1,408 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+    Standalone benchmark of the Rhythm frame decode path
+
+    Decodes synthetic USB transfers the way DeviceThread::updateBuffer()
+    does (header check, timestamp scan, FrameDecoder::decodeFrames) for a
+    range of stream counts, headstage chip mixes and aux/ADC settings, and
+    runs the old Rhd2000DataBlockUsb3::fillFromUsbBuffer() on the same
+    buffers for comparison. For each case it prints the time per sample
+    (one frame), the amplifier channel-samples decoded per second, and the
+    headroom: how many times faster than real time the decode runs.
+
+    Usage: rhythm-decode-benchmark [--streams 1,2,4] [--seconds 0.25]
+                                   [--rate 30000] [--level scalar|sse2|avx2]
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../Source/FrameDecoder.h"
+#include "../Source/rhythm-api/rhd2000datablockusb3.h" // needs <fstream> and <vector> first
+
+using namespace RhythmNode;
+
+namespace
+{
+/** Frames in one synthetic USB transfer (one data block, as read by default) */
+const int framesPerTransfer = SAMPLES_PER_DATA_BLOCK;
+
+/** Transfers cycled through by each case; enough data to spill out of the caches at high stream counts */
+const int numTransfers = 16;
+
+/** Data streams on the 1024-channel Recording Controller */
+const int maxNumStreams = 32;
+
+const int chipIdRhd2132 = 1;
+const int chipIdRhd2216 = 2;
+const int chipIdRhd2164 = 4;
+
+struct ChipMix
+{
+    const char* name;
+    std::vector<int> chips;
+};
+
+struct Options
+{
+    std::vector<int> streamCounts = { 1, 2, 3, 4, 8, 16, 32 };
+    double seconds = 0.25;
+    double sampleRate = 30000.0;
+    DecodeKernels::Level level = DecodeKernels::getBestLevel();
+};
+
+struct Result
+{
+    double nsPerSample;
+    double channelSamplesPerSecond;
+    double headroom;
+};
+
+/** Lays out numStreams streams from a repeating list of headstage chips, the way scanPorts() enables them */
+std::vector<DecodePlan::StreamLayout> createLayouts (const ChipMix& mix, int numStreams)
+{
+    std::vector<DecodePlan::StreamLayout> layouts;
+
+    for (int i = 0; layouts.size() < (size_t) numStreams; i++)
+    {
+        const int chipId = mix.chips[i % mix.chips.size()];
+
+        if (chipId == chipIdRhd2164 && layouts.size() + 2 <= (size_t) numStreams)
+        {
+            // one headstage, two MISO lines; only the first carries the aux inputs
+            layouts.push_back ({ 32, 0, true });
+            layouts.push_back ({ 32, 0, false });
+        }
+        else if (chipId == chipIdRhd2216)
+        {
+            layouts.push_back ({ 16, 0, true });
+        }
+        else
+        {
+            layouts.push_back ({ 32, 0, true });
+        }
+    }
+
+    return layouts;
+}
+
+/** Fills a buffer with numFrames valid frames: header, consecutive timestamps, and noise around mid-scale */
+std::vector<uint16_t> createFrames (int numStreams, int numFrames)
+{
+    const int frameWords = DecodePlan::getFrameWords (numStreams);
+    std::vector<uint16_t> frames ((size_t) frameWords * numFrames);
+
+    uint32_t random = 0x2468ace1;
+
+    for (int f = 0; f < numFrames; f++)
+    {
+        uint16_t* frame = frames.data() + (size_t) f * frameWords;
+
+        frame[0] = 0x2a53;
+        frame[1] = 0x3813;
+        frame[2] = 0x2aaa;
+        frame[3] = 0xd7a2;
+        frame[4] = (uint16_t) (f & 0xffff);
+        frame[5] = (uint16_t) (f >> 16);
+
+        for (int w = 6; w < frameWords; w++)
+        {
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            frame[w] = (uint16_t) (32768 + (int) (random & 0x3ff) - 512);
+        }
+    }
+
+    return frames;
+}
+
+/** Output buffers for one transfer, laid out as in DeviceThread */
+class DecodeBuffers
+{
+public:
+    explicit DecodeBuffers (const DecodePlan& plan)
+        : sampleNumbers (framesPerTransfer),
+          ttl (framesPerTransfer),
+          aux ((size_t) (framesPerTransfer / 4 + 1) * std::max (1, plan.numAuxChannels)),
+          auxSampleNumbers (framesPerTransfer / 4 + 1)
+    {
+        for (const auto& group : plan.groups)
+            groupSamples.emplace_back ((size_t) framesPerTransfer * std::max (1, group.numChannels));
+
+        for (auto& samples : groupSamples)
+            outputs.push_back (samples.data());
+    }
+
+    std::vector<std::vector<float>> groupSamples;
+    std::vector<float*> outputs;
+    std::vector<long long> sampleNumbers;
+    std::vector<unsigned long long> ttl;
+    std::vector<float> aux;
+    std::vector<long long> auxSampleNumbers;
+};
+
+/** Decodes one transfer as DeviceThread::updateBuffer() does: runs of frames with valid headers, one decode call per run */
+int decodeTransfer (FrameDecoder& decoder, unsigned char* transfer, int numBytes, DecodeBuffers& buffers)
+{
+    const DecodePlan& plan = decoder.getPlan();
+    const int frameBytes = 2 * plan.frameWords;
+
+    int index = 0;
+    int numSamples = 0;
+    int numAuxSamples = 0;
+
+    std::vector<float*> runOutputs (buffers.outputs.size());
+
+    while (index + frameBytes <= numBytes)
+    {
+        if (! Rhd2000DataBlockUsb3::checkUsbHeader (transfer, index))
+        {
+            index += 2;
+            continue;
+        }
+
+        const uint16_t* frames = (const uint16_t*) (transfer + index);
+        const int runStart = numSamples;
+
+        do
+        {
+            buffers.sampleNumbers[numSamples++] = DecodePlan::getTimestamp ((const uint16_t*) (transfer + index));
+            index += frameBytes;
+
+        } while (index + frameBytes <= numBytes && Rhd2000DataBlockUsb3::checkUsbHeader (transfer, index));
+
+        for (size_t g = 0; g < runOutputs.size(); g++)
+            runOutputs[g] = buffers.outputs[g] + (size_t) runStart * plan.groups[g].numChannels;
+
+        numAuxSamples += decoder.decodeFrames (frames,
+                                               numSamples - runStart,
+                                               buffers.sampleNumbers.data() + runStart,
+                                               runOutputs.data(),
+                                               buffers.ttl.data() + runStart,
+                                               buffers.aux.data() + (size_t) numAuxSamples * plan.numAuxChannels,
+                                               buffers.auxSampleNumbers.data() + numAuxSamples);
+    }
+
+    return numSamples;
+}
+
+/** Calls process (transfer index) over and over for about the given time, after one warm-up pass */
+template <typename Function>
+double timePasses (double seconds, Function process, int64_t& numTransfersDone)
+{
+    for (int t = 0; t < numTransfers; t++)
+        process (t);
+
+    const auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    numTransfersDone = 0;
+
+    while (elapsed < seconds)
+    {
+        for (int t = 0; t < numTransfers; t++)
+            process (t);
+
+        numTransfersDone += numTransfers;
+        elapsed = std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+    }
+
+    return elapsed;
+}
+
+Result makeResult (double elapsed, int64_t numTransfersDone, int numChannels, double sampleRate)
+{
+    const double numSamples = (double) numTransfersDone * framesPerTransfer;
+    const double samplesPerSecond = numSamples / elapsed;
+
+    return { 1e9 * elapsed / numSamples, samplesPerSecond * numChannels, samplesPerSecond / sampleRate };
+}
+
+Result benchmarkDecoder (const DecodePlan& plan, std::vector<uint16_t>& frames, const Options& options)
+{
+    FrameDecoder decoder (plan, options.level);
+    DecodeBuffers buffers (plan);
+
+    const int transferBytes = 2 * plan.frameWords * framesPerTransfer;
+    unsigned char* data = reinterpret_cast<unsigned char*> (frames.data());
+
+    int64_t numTransfersDone;
+    const double elapsed = timePasses (options.seconds, [&] (int t)
+                                       { decodeTransfer (decoder, data + (size_t) t * transferBytes, transferBytes, buffers); },
+                                       numTransfersDone);
+
+    return makeResult (elapsed, numTransfersDone, plan.numAmplifierChannels, options.sampleRate);
+}
+
+Result benchmarkDataBlock (int numStreams, std::vector<uint16_t>& frames, const Options& options)
+{
+    Rhd2000DataBlockUsb3 dataBlock (numStreams);
+
+    const int transferBytes = 2 * DecodePlan::getFrameWords (numStreams) * framesPerTransfer;
+    unsigned char* data = reinterpret_cast<unsigned char*> (frames.data());
+
+    int64_t numTransfersDone;
+    const double elapsed = timePasses (options.seconds, [&] (int t)
+                                       { dataBlock.fillFromUsbBuffer (data + (size_t) t * transferBytes, 0, numStreams, framesPerTransfer); },
+                                       numTransfersDone);
+
+    return makeResult (elapsed, numTransfersDone, 32 * numStreams, options.sampleRate);
+}
+
+void printRow (int numStreams, const char* path, const char* chips, const char* aux, const char* adc, int numChannels, const Result& result)
+{
+    printf ("%7d  %-17s  %-8s  %-3s  %-3s  %8d  %10.1f  %14.1f  %8.1fx\n",
+            numStreams,
+            path,
+            chips,
+            aux,
+            adc,
+            numChannels,
+            result.nsPerSample,
+            result.channelSamplesPerSecond / 1e6,
+            result.headroom);
+}
+
+bool parseOptions (int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (value == nullptr)
+            return false;
+
+        if (arg == "--streams")
+        {
+            options.streamCounts.clear();
+
+            std::stringstream list (value);
+            std::string entry;
+
+            while (std::getline (list, entry, ','))
+            {
+                const int numStreams = atoi (entry.c_str());
+
+                if (numStreams < 1 || numStreams > maxNumStreams)
+                    return false;
+
+                options.streamCounts.push_back (numStreams);
+            }
+        }
+        else if (arg == "--seconds")
+        {
+            options.seconds = atof (value);
+        }
+        else if (arg == "--rate")
+        {
+            options.sampleRate = atof (value);
+        }
+        else if (arg == "--level")
+        {
+            const std::string level = value;
+
+            if (level == "scalar")
+                options.level = DecodeKernels::Level::Scalar;
+            else if (level == "sse2")
+                options.level = DecodeKernels::Level::SSE2;
+            else if (level == "avx2")
+                options.level = DecodeKernels::Level::AVX2;
+            else
+                return false;
+        }
+        else
+        {
+            return false;
+        }
+
+        i++;
+    }
+
+    return ! options.streamCounts.empty() && options.seconds > 0.0 && options.sampleRate > 0.0;
+}
+
+} // namespace
+
+int main (int argc, char* argv[])
+{
+    Options options;
+
+    if (! parseOptions (argc, argv, options))
+    {
+        fprintf (stderr, "Usage: %s [--streams 1,2,4] [--seconds 0.25] [--rate 30000] [--level scalar|sse2|avx2]\n", argv[0]);
+        return 1;
+    }
+
+    const std::vector<ChipMix> mixes = { { "RHD2132", { chipIdRhd2132 } },
+                                         { "RHD2164", { chipIdRhd2164 } },
+                                         { "RHD2216", { chipIdRhd2216 } },
+                                         { "mixed", { chipIdRhd2164, chipIdRhd2132, chipIdRhd2216 } } };
+
+    printf ("Rhythm decode benchmark: %s amplifier kernel (best on this CPU: %s), %.0f Hz real time, %d-frame transfers\n\n",
+            DecodeKernels::getLevelName (options.level),
+            DecodeKernels::getLevelName (DecodeKernels::getBestLevel()),
+            options.sampleRate,
+            framesPerTransfer);
+
+    printf ("%7s  %-17s  %-8s  %-3s  %-3s  %8s  %10s  %14s  %9s\n", "streams", "path", "chips", "aux", "adc", "channels", "ns/sample", "Mch*samples/s", "headroom");
+
+    for (int numStreams : options.streamCounts)
+    {
+        std::vector<uint16_t> frames = createFrames (numStreams, framesPerTransfer * numTransfers);
+
+        printRow (numStreams, "fillFromUsbBuffer", "-", "-", "-", 32 * numStreams, benchmarkDataBlock (numStreams, frames, options));
+
+        for (const auto& mix : mixes)
+        {
+            const std::vector<DecodePlan::StreamLayout> layouts = createLayouts (mix, numStreams);
+
+            for (int settings = 0; settings < 4; settings++)
+            {
+                const bool acquireAux = (settings & 1) != 0;
+                const bool acquireAdc = (settings & 2) != 0;
+
+                const DecodePlan plan (layouts, acquireAux, acquireAdc);
+
+                printRow (numStreams,
+                          "FrameDecoder",
+                          mix.name,
+                          acquireAux ? "on" : "off",
+                          acquireAdc ? "on" : "off",
+                          plan.numAmplifierChannels,
+                          benchmarkDecoder (plan, frames, options));
+            }
+        }
+
+        printf ("\n");
+    }
+
+    return 0;
+}
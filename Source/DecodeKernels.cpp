@@ -0,0 +1,286 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "DecodeKernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RHYTHM_DECODE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define RHYTHM_TARGET_AVX2
+#else
+#define RHYTHM_TARGET_AVX2 __attribute__ ((target ("avx2")))
+#endif
+#else
+#define RHYTHM_DECODE_X86 0
+#endif
+
+using namespace RhythmNode;
+
+namespace
+{
+const int channelsPerStream = 32;
+
+/* Kernels are templated on the stream count so the common layouts get constant
+   strides the compiler can unroll; NumStreams == 0 reads the count at runtime. */
+
+template <int NumStreams>
+inline void deinterleaveScalar (const uint16_t* src, int runtimeStreams, float* dest, int firstStream, int endStream, float scale)
+{
+    const int numStreams = NumStreams > 0 ? NumStreams : runtimeStreams;
+
+    for (int stream = firstStream; stream < endStream; stream++)
+    {
+        float* out = dest + (stream - firstStream) * channelsPerStream;
+        const uint16_t* in = src + stream;
+
+        for (int chan = 0; chan < channelsPerStream; chan++)
+            out[chan] = (float (in[chan * numStreams]) - 32768.0f) * scale;
+    }
+}
+
+template <int NumStreams>
+void amplifierKernelScalar (const uint16_t* src, size_t srcFrameStride, int numStreams, int firstStream, int endStream, int numFrames, float* dest, size_t destFrameStride, float scale)
+{
+    for (int frame = 0; frame < numFrames; frame++)
+        deinterleaveScalar<NumStreams> (src + frame * srcFrameStride, numStreams, dest + frame * destFrameStride, firstStream, endStream, scale);
+}
+
+#if RHYTHM_DECODE_X86
+
+/** Loads 8 channels x 8 streams of words and transposes them, so that
+    rows[i] holds channels firstChan..firstChan+7 of stream firstStream+i,
+    already offset to signed (word - 32768) */
+template <int NumStreams>
+inline void loadTransposed8x8 (const uint16_t* src, int runtimeStreams, int firstChan, int firstStream, __m128i* rows)
+{
+    const int numStreams = NumStreams > 0 ? NumStreams : runtimeStreams;
+    const __m128i signFlip = _mm_set1_epi16 ((short) 0x8000);
+    __m128i r[8];
+
+    for (int i = 0; i < 8; i++)
+        r[i] = _mm_loadu_si128 ((const __m128i*) (src + (firstChan + i) * numStreams + firstStream));
+
+    __m128i t0 = _mm_unpacklo_epi16 (r[0], r[1]);
+    __m128i t1 = _mm_unpackhi_epi16 (r[0], r[1]);
+    __m128i t2 = _mm_unpacklo_epi16 (r[2], r[3]);
+    __m128i t3 = _mm_unpackhi_epi16 (r[2], r[3]);
+    __m128i t4 = _mm_unpacklo_epi16 (r[4], r[5]);
+    __m128i t5 = _mm_unpackhi_epi16 (r[4], r[5]);
+    __m128i t6 = _mm_unpacklo_epi16 (r[6], r[7]);
+    __m128i t7 = _mm_unpackhi_epi16 (r[6], r[7]);
+
+    __m128i u0 = _mm_unpacklo_epi32 (t0, t2);
+    __m128i u1 = _mm_unpackhi_epi32 (t0, t2);
+    __m128i u2 = _mm_unpacklo_epi32 (t1, t3);
+    __m128i u3 = _mm_unpackhi_epi32 (t1, t3);
+    __m128i u4 = _mm_unpacklo_epi32 (t4, t6);
+    __m128i u5 = _mm_unpackhi_epi32 (t4, t6);
+    __m128i u6 = _mm_unpacklo_epi32 (t5, t7);
+    __m128i u7 = _mm_unpackhi_epi32 (t5, t7);
+
+    rows[0] = _mm_xor_si128 (_mm_unpacklo_epi64 (u0, u4), signFlip);
+    rows[1] = _mm_xor_si128 (_mm_unpackhi_epi64 (u0, u4), signFlip);
+    rows[2] = _mm_xor_si128 (_mm_unpacklo_epi64 (u1, u5), signFlip);
+    rows[3] = _mm_xor_si128 (_mm_unpackhi_epi64 (u1, u5), signFlip);
+    rows[4] = _mm_xor_si128 (_mm_unpacklo_epi64 (u2, u6), signFlip);
+    rows[5] = _mm_xor_si128 (_mm_unpackhi_epi64 (u2, u6), signFlip);
+    rows[6] = _mm_xor_si128 (_mm_unpacklo_epi64 (u3, u7), signFlip);
+    rows[7] = _mm_xor_si128 (_mm_unpackhi_epi64 (u3, u7), signFlip);
+}
+
+template <int NumStreams>
+void amplifierKernelSSE2 (const uint16_t* src, size_t srcFrameStride, int runtimeStreams, int firstStream, int endStream, int numFrames, float* dest, size_t destFrameStride, float scale)
+{
+    const int numStreams = NumStreams > 0 ? NumStreams : runtimeStreams;
+    const __m128 scaleVec = _mm_set1_ps (scale);
+    const int vectorEnd = firstStream + ((endStream - firstStream) & ~7);
+
+    for (int frame = 0; frame < numFrames; frame++)
+    {
+        const uint16_t* in = src + frame * srcFrameStride;
+        float* out = dest + frame * destFrameStride;
+
+        for (int stream = firstStream; stream < vectorEnd; stream += 8)
+        {
+            for (int chan = 0; chan < channelsPerStream; chan += 8)
+            {
+                __m128i rows[8];
+                loadTransposed8x8<NumStreams> (in, numStreams, chan, stream, rows);
+
+                for (int i = 0; i < 8; i++)
+                {
+                    // sign-extend to 32 bits by unpacking into the high halves and shifting down
+                    __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (rows[i], rows[i]), 16);
+                    __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (rows[i], rows[i]), 16);
+
+                    float* o = out + (stream - firstStream + i) * channelsPerStream + chan;
+                    _mm_storeu_ps (o, _mm_mul_ps (_mm_cvtepi32_ps (lo), scaleVec));
+                    _mm_storeu_ps (o + 4, _mm_mul_ps (_mm_cvtepi32_ps (hi), scaleVec));
+                }
+            }
+        }
+
+        deinterleaveScalar<NumStreams> (in, numStreams, out + (vectorEnd - firstStream) * channelsPerStream, vectorEnd, endStream, scale);
+    }
+}
+
+template <int NumStreams>
+RHYTHM_TARGET_AVX2 void amplifierKernelAVX2 (const uint16_t* src, size_t srcFrameStride, int runtimeStreams, int firstStream, int endStream, int numFrames, float* dest, size_t destFrameStride, float scale)
+{
+    const int numStreams = NumStreams > 0 ? NumStreams : runtimeStreams;
+    const __m256 scaleVec = _mm256_set1_ps (scale);
+    const int vectorEnd = firstStream + ((endStream - firstStream) & ~7);
+
+    for (int frame = 0; frame < numFrames; frame++)
+    {
+        const uint16_t* in = src + frame * srcFrameStride;
+        float* out = dest + frame * destFrameStride;
+
+        for (int stream = firstStream; stream < vectorEnd; stream += 8)
+        {
+            for (int chan = 0; chan < channelsPerStream; chan += 8)
+            {
+                __m128i rows[8];
+                loadTransposed8x8<NumStreams> (in, numStreams, chan, stream, rows);
+
+                for (int i = 0; i < 8; i++)
+                {
+                    __m256 values = _mm256_cvtepi32_ps (_mm256_cvtepi16_epi32 (rows[i]));
+                    _mm256_storeu_ps (out + (stream - firstStream + i) * channelsPerStream + chan, _mm256_mul_ps (values, scaleVec));
+                }
+            }
+        }
+
+        deinterleaveScalar<NumStreams> (in, numStreams, out + (vectorEnd - firstStream) * channelsPerStream, vectorEnd, endStream, scale);
+    }
+}
+
+bool cpuHasAvx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid (info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // AVX2 also needs the OS to save the YMM registers
+    __cpuid (info, 1);
+    const int osxsaveAndAvx = (1 << 27) | (1 << 28);
+    if ((info[2] & osxsaveAndAvx) != osxsaveAndAvx || (_xgetbv (0) & 6) != 6)
+        return false;
+
+    __cpuidex (info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports ("avx2");
+#endif
+}
+
+#endif // RHYTHM_DECODE_X86
+
+} // namespace
+
+DecodeKernels::Level DecodeKernels::getBestLevel()
+{
+#if RHYTHM_DECODE_X86
+    static const Level best = cpuHasAvx2() ? Level::AVX2 : Level::SSE2;
+    return best;
+#else
+    return Level::Scalar;
+#endif
+}
+
+namespace
+{
+template <int NumStreams>
+DecodeKernels::AmplifierKernel getKernelForLevel (DecodeKernels::Level level)
+{
+    switch (level)
+    {
+#if RHYTHM_DECODE_X86
+        case DecodeKernels::Level::AVX2:
+            return amplifierKernelAVX2<NumStreams>;
+        case DecodeKernels::Level::SSE2:
+            return amplifierKernelSSE2<NumStreams>;
+#endif
+        default:
+            return amplifierKernelScalar<NumStreams>;
+    }
+}
+
+/** Stream counts with their own kernel instances, in dispatch table order */
+const int specialisedStreamCounts[] = { 2, 4, 8, 16, 32 };
+const int numSpecialisedStreamCounts = 5;
+
+typedef DecodeKernels::AmplifierKernel (*KernelSelector) (DecodeKernels::Level);
+
+const KernelSelector specialisedKernels[] = { getKernelForLevel<2>,
+                                              getKernelForLevel<4>,
+                                              getKernelForLevel<8>,
+                                              getKernelForLevel<16>,
+                                              getKernelForLevel<32> };
+} // namespace
+
+bool DecodeKernels::isSpecialised (int numStreams)
+{
+    for (int i = 0; i < numSpecialisedStreamCounts; i++)
+    {
+        if (specialisedStreamCounts[i] == numStreams)
+            return true;
+    }
+
+    return false;
+}
+
+DecodeKernels::AmplifierKernel DecodeKernels::getAmplifierKernel (Level level, int numStreams)
+{
+    if (level > getBestLevel())
+        level = getBestLevel();
+
+    for (int i = 0; i < numSpecialisedStreamCounts; i++)
+    {
+        if (specialisedStreamCounts[i] == numStreams)
+            return specialisedKernels[i] (level);
+    }
+
+    return getKernelForLevel<0> (level);
+}
+
+DecodeKernels::AmplifierKernel DecodeKernels::getAmplifierKernel (int numStreams)
+{
+    return getAmplifierKernel (getBestLevel(), numStreams);
+}
+
+const char* DecodeKernels::getLevelName (Level level)
+{
+    switch (level)
+    {
+        case Level::AVX2:
+            return "AVX2";
+        case Level::SSE2:
+            return "SSE2";
+        default:
+            return "scalar";
+    }
+}
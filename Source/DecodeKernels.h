@@ -0,0 +1,94 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DECODEKERNELS_H
+#define DECODEKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace RhythmNode
+{
+
+/**
+        Vectorised conversion kernels for Rhythm USB frames
+
+        Amplifier words arrive channel-major within a frame (all streams for
+        channel 0, then all streams for channel 1, ...). The kernels transpose
+        them into stream-major order (32 channels of stream 0, then stream 1,
+        ...) and convert them to floats in one pass.
+
+        The SSE2 and AVX2 versions are chosen at runtime from the CPU features;
+        everything else uses the scalar version. Each version is also compiled
+        for the common stream counts, picked from a dispatch table by
+        getAmplifierKernel() when acquisition starts. This file does not depend on
+        JUCE, so it can be built into standalone tools.
+    */
+namespace DecodeKernels
+{
+    enum class Level
+    {
+        Scalar = 0,
+        SSE2 = 1,
+        AVX2 = 2
+    };
+
+    /** Signature of an amplifier deinterleave kernel.
+
+        src points at the first amplifier word of the first frame, holding
+        32 * numStreams words per frame, with frames srcFrameStride words apart.
+        For each frame, streams firstStream to endStream - 1 are converted into
+        dest (32 floats per stream, stream firstStream first), with frames
+        destFrameStride floats apart. Each value is (word - 32768) * scale. */
+    typedef void (*AmplifierKernel) (const uint16_t* src,
+                                     size_t srcFrameStride,
+                                     int numStreams,
+                                     int firstStream,
+                                     int endStream,
+                                     int numFrames,
+                                     float* dest,
+                                     size_t destFrameStride,
+                                     float scale);
+
+    /** Returns the fastest kernel level supported by this CPU */
+    Level getBestLevel();
+
+    /** Returns the amplifier kernel for a level and stream count. Stream counts of
+        2, 4, 8, 16 and 32 get instances compiled for that count (constant strides,
+        fully unrolled); others use a generic instance. Falls back to the best
+        level this CPU supports. */
+    AmplifierKernel getAmplifierKernel (Level level, int numStreams);
+
+    /** Returns the amplifier kernel for the fastest supported level */
+    AmplifierKernel getAmplifierKernel (int numStreams);
+
+    /** Returns true if a kernel is compiled specifically for this stream count */
+    bool isSpecialised (int numStreams);
+
+    /** Returns a short name for a kernel level, for logging */
+    const char* getLevelName (Level level);
+
+} // namespace DecodeKernels
+
+} // namespace RhythmNode
+
+#endif // DECODEKERNELS_H
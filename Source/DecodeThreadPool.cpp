@@ -0,0 +1,127 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "DecodeThreadPool.h"
+
+using namespace RhythmNode;
+
+DecodeThreadPool::Worker::Worker (DecodeThreadPool& pool_, int index, int firstStream_, int endStream_)
+    : Thread ("Rhythm decode " + String (index)),
+      pool (pool_),
+      firstStream (firstStream_),
+      endStream (endStream_)
+{
+}
+
+void DecodeThreadPool::Worker::run()
+{
+    while (! threadShouldExit())
+    {
+        if (! jobReady.wait (100) || threadShouldExit())
+            continue;
+
+        pool.decoder.decodeAmplifiers (pool.jobFrames, pool.jobNumFrames, pool.jobOutputs, firstStream, endStream);
+
+        if (--pool.workersBusy == 0)
+            pool.jobDone.signal();
+    }
+}
+
+DecodeThreadPool::DecodeThreadPool (FrameDecoder& decoder_, int numWorkers, int firstCore)
+    : decoder (decoder_)
+{
+    const int numStreams = decoder.getPlan().numStreams;
+    const int numParts = jlimit (1, jmax (1, numStreams), numWorkers + 1);
+
+    // split evenly, and cut on multiples of 8 streams (whole SIMD groups) only when
+    // that leaves the parts as balanced as the even split
+    Array<int> evenBoundaries, groupBoundaries;
+    for (int part = 0; part < numParts; part++)
+    {
+        int boundary = numStreams * part / numParts;
+        evenBoundaries.add (boundary);
+        groupBoundaries.add (boundary / 8 * 8);
+    }
+    evenBoundaries.add (numStreams);
+    groupBoundaries.add (numStreams);
+
+    auto getSpread = [numParts] (const Array<int>& b)
+    {
+        int smallest = b[1] - b[0];
+        int largest = smallest;
+
+        for (int part = 1; part < numParts; part++)
+        {
+            smallest = jmin (smallest, b[part + 1] - b[part]);
+            largest = jmax (largest, b[part + 1] - b[part]);
+        }
+
+        return largest - smallest;
+    };
+
+    const Array<int> boundaries = getSpread (groupBoundaries) <= getSpread (evenBoundaries) ? groupBoundaries : evenBoundaries;
+
+    callerEndStream = boundaries[1];
+
+    for (int part = 1; part < numParts; part++)
+    {
+        Worker* worker = workers.add (new Worker (*this, part, boundaries[part], boundaries[part + 1]));
+
+        if (firstCore >= 0 && firstCore + part - 1 < 32)
+            worker->setAffinityMask ((uint32) 1 << (firstCore + part - 1));
+
+        worker->startThread();
+    }
+
+    LOGD ("Decoding ", numStreams, " streams on ", numParts, " threads, ", callerEndStream, " streams on the acquisition thread");
+}
+
+DecodeThreadPool::~DecodeThreadPool()
+{
+    for (auto* worker : workers)
+    {
+        worker->signalThreadShouldExit();
+        worker->wake();
+    }
+
+    for (auto* worker : workers)
+        worker->stopThread (1000);
+}
+
+int DecodeThreadPool::decodeFrames (const uint16* frames, int numFrames, const int64* sampleNumbers, float* const* outputs, uint64* ttl, float* auxOut, int64* auxSampleNumbers)
+{
+    jobFrames = frames;
+    jobNumFrames = numFrames;
+    jobOutputs = outputs;
+    workersBusy = workers.size();
+
+    for (auto* worker : workers)
+        worker->startJob();
+
+    decoder.decodeAmplifiers (frames, numFrames, outputs, 0, callerEndStream);
+    int numAuxSamples = decoder.decodeNonAmplifiers (frames, numFrames, sampleNumbers, outputs, ttl, auxOut, auxSampleNumbers);
+
+    while (workersBusy.load() > 0)
+        jobDone.wait (100);
+
+    return numAuxSamples;
+}
@@ -0,0 +1,105 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DECODETHREADPOOL_H
+#define DECODETHREADPOOL_H
+
+#include <DataThreadHeaders.h>
+
+#include "FrameDecoder.h"
+
+#include <atomic>
+
+namespace RhythmNode
+{
+
+/**
+        Splits the amplifier decode of each run of frames across worker threads
+
+        Every worker owns a fixed range of data streams (whole groups of 8
+        when that keeps the parts balanced, so the SIMD kernels keep their
+        full width) and writes only those streams' channels of the output block.
+        The calling thread decodes the first range plus the aux, ADC and TTL
+        words, then waits for the workers, so the block is complete when
+        decodeFrames() returns and can go straight to the DataBuffer.
+
+        Only worthwhile for large rigs (hundreds of channels); with few
+        streams the wake-up cost outweighs the work.
+    */
+class DecodeThreadPool
+{
+public:
+    /** Starts numWorkers threads (fewer if there are not enough streams to split).
+        If firstCore >= 0, worker i is pinned to core firstCore + i. */
+    DecodeThreadPool (FrameDecoder& decoder, int numWorkers, int firstCore);
+
+    /** Stops the workers */
+    ~DecodeThreadPool();
+
+    /** Decodes numFrames frames like FrameDecoder::decodeFrames(), returning once every
+        worker has finished its part */
+    int decodeFrames (const uint16* frames, int numFrames, const int64* sampleNumbers, float* const* outputs, uint64* ttl, float* auxOut, int64* auxSampleNumbers);
+
+    /** Returns the number of worker threads (not counting the calling thread) */
+    int getNumWorkers() const { return workers.size(); }
+
+private:
+    class Worker : public Thread
+    {
+    public:
+        Worker (DecodeThreadPool& pool, int index, int firstStream, int endStream);
+
+        void run() override;
+
+        /** Wakes the worker to decode the current job */
+        void startJob() { jobReady.signal(); }
+
+        /** Wakes the worker so it can see that it should exit */
+        void wake() { jobReady.signal(); }
+
+    private:
+        DecodeThreadPool& pool;
+        const int firstStream;
+        const int endStream;
+        WaitableEvent jobReady;
+    };
+
+    FrameDecoder& decoder;
+    OwnedArray<Worker> workers;
+
+    /** Streams decoded on the calling thread */
+    int callerEndStream;
+
+    /** Current job, written before the workers are woken */
+    const uint16* jobFrames = nullptr;
+    int jobNumFrames = 0;
+    float* const* jobOutputs = nullptr;
+
+    std::atomic<int> workersBusy { 0 };
+    WaitableEvent jobDone;
+
+    JUCE_DECLARE_NON_COPYABLE (DecodeThreadPool);
+};
+
+} // namespace RhythmNode
+
+#endif // DECODETHREADPOOL_H
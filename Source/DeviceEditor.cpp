@@ -23,6 +23,7 @@
 
 #include "DeviceEditor.h"
 #include "DeviceThread.h"
+#include "Headstage.h"
 
 #include "UI/ChannelCanvas.h"
 
@@ -41,10 +42,11 @@ inline double round (double x)
 
 #define HS_WIDTH 70
 #define HS_PANEL_WIDTH 80
+#define USB_PANEL_WIDTH 80
 
 DeviceEditor::DeviceEditor (GenericProcessor* parentNode,
                             DeviceThread* board_)
-    : VisualizerEditor (parentNode, "RHD Controller", 330 + HS_WIDTH), board (board_)
+    : VisualizerEditor (parentNode, "RHD Controller", 330 + HS_WIDTH + USB_PANEL_WIDTH), board (board_)
 {
     canvas = nullptr;
     noBoardsDetectedLabel = nullptr;
@@ -202,6 +204,11 @@ DeviceEditor::DeviceEditor (GenericProcessor* parentNode,
     }
     ttlSettleCombo->setSelectedId (1, sendNotification);
     addAndMakeVisible (ttlSettleCombo.get());
+
+    // add USB transfer settings
+    usbInterface = std::make_unique<UsbInterface> (board, this);
+    addAndMakeVisible (usbInterface.get());
+    usbInterface->setBounds (330 + HS_PANEL_WIDTH, 22, USB_PANEL_WIDTH - 10, 105);
 }
 
 void DeviceEditor::measureImpedance()
@@ -364,6 +371,7 @@ void DeviceEditor::startAcquisition()
     auxButton->setEnabledState (false);
     adcButton->setEnabledState (false);
     dspoffsetButton->setEnabledState (false);
+    usbInterface->setControlsEnabled (false);
 
     for (auto headstageOptions : headstageOptionsInterfaces)
     {
@@ -384,6 +392,7 @@ void DeviceEditor::stopAcquisition()
     auxButton->setEnabledState (true);
     adcButton->setEnabledState (true);
     dspoffsetButton->setEnabledState (true);
+    usbInterface->setControlsEnabled (true);
 
     for (auto headstageOptions : headstageOptionsInterfaces)
     {
@@ -420,6 +429,23 @@ void DeviceEditor::saveVisualizerEditorParameters (XmlElement* xml)
     xml->setAttribute ("save_impedance_measurements", saveImpedances);
     xml->setAttribute ("auto_measure_impedances", measureWhenRecording);
     xml->setAttribute ("ClockDivideRatio", clockInterface->getClockDivideRatio());
+    xml->setAttribute ("USBBufferCount", board->getUsbBufferCount());
+    xml->setAttribute ("USBBlocksPerRead", usbInterface->getBlocksPerRead());
+    xml->setAttribute ("USBTransferMode", usbInterface->getTransferMode());
+    xml->setAttribute ("USBTargetLatency", usbInterface->getTargetLatency());
+    xml->setAttribute ("USBChunkSamples", usbInterface->getChunkSize());
+    xml->setAttribute ("DecodeThreads", board->getDecodeThreads());
+    xml->setAttribute ("DecodeFirstCore", board->getDecodeFirstCore());
+    xml->setAttribute ("StreamPerHeadstage", board->getStreamPerHeadstage());
+    xml->setAttribute ("PowerDownDisabledAmps", board->getPowerDownDisabledAmps());
+    xml->setAttribute ("AdaptiveImpedanceRanges", board->getAdaptiveImpedanceRanges());
+
+    StringArray impedanceFrequencies;
+    for (float frequency : board->getImpedanceFrequencies())
+        impedanceFrequencies.add (String (frequency));
+    xml->setAttribute ("ImpedanceFrequencies", impedanceFrequencies.joinIntoString (","));
+
+    xml->setAttribute ("RawFrameDirectory", board->getRawFrameDirectory());
 
     // loop through all headstage options interfaces and save their parameters
     for (int i = 0; i < 4; i++)
@@ -430,6 +456,25 @@ void DeviceEditor::saveVisualizerEditorParameters (XmlElement* xml)
         hsOptions->setAttribute ("hs2_full_channels", headstageOptionsInterfaces[i]->is32Channel (1));
     }
 
+    // save the disabled channels of each headstage
+    for (auto hs : board->getConnectedHeadstages())
+    {
+        StringArray disabledChannels;
+
+        for (int ch = 0; ch < hs->getNumActiveChannels(); ch++)
+        {
+            if (! hs->isChannelEnabled (ch))
+                disabledChannels.add (String (ch));
+        }
+
+        if (disabledChannels.size() > 0)
+        {
+            XmlElement* channelMask = xml->createNewChildElement ("CHANNELMASK");
+            channelMask->setAttribute ("headstage", hs->getDataStream (0) / 2);
+            channelMask->setAttribute ("disabled", disabledChannels.joinIntoString (","));
+        }
+    }
+
     for (int i = 0; i < 8; i++)
     {
         XmlElement* adc = xml->createNewChildElement ("ADCRANGE");
@@ -461,6 +506,37 @@ void DeviceEditor::loadVisualizerEditorParameters (XmlElement* xml)
     saveImpedances = xml->getBoolAttribute ("save_impedance_measurements");
     measureWhenRecording = xml->getBoolAttribute ("auto_measure_impedances");
     clockInterface->setClockDivideRatio (xml->getIntAttribute ("ClockDivideRatio"));
+    board->setUsbBufferCount (xml->getIntAttribute ("USBBufferCount", 8));
+    usbInterface->setBlocksPerRead (xml->getIntAttribute ("USBBlocksPerRead", 0));
+    usbInterface->setTransferMode (xml->getIntAttribute ("USBTransferMode", FIXED_TRANSFERS));
+    usbInterface->setTargetLatency (xml->getDoubleAttribute ("USBTargetLatency", 10.0));
+    usbInterface->setChunkSize (xml->getIntAttribute ("USBChunkSamples", 16));
+    board->setDecodeThreads (xml->getIntAttribute ("DecodeThreads", 0));
+    board->setDecodeFirstCore (xml->getIntAttribute ("DecodeFirstCore", -1));
+    board->setStreamPerHeadstage (xml->getBoolAttribute ("StreamPerHeadstage", false));
+    board->setPowerDownDisabledAmps (xml->getBoolAttribute ("PowerDownDisabledAmps", false));
+    board->setAdaptiveImpedanceRanges (xml->getBoolAttribute ("AdaptiveImpedanceRanges", false));
+
+    Array<float> impedanceFrequencies;
+    for (auto frequency : StringArray::fromTokens (xml->getStringAttribute ("ImpedanceFrequencies", ""), ",", ""))
+        if (frequency.trim().isNotEmpty())
+            impedanceFrequencies.add (frequency.getFloatValue());
+    board->setImpedanceFrequencies (impedanceFrequencies);
+
+    board->setRawFrameDirectory (xml->getStringAttribute ("RawFrameDirectory", ""));
+
+    // the audio outputs count enabled channels, so restore the channel masks first;
+    // the saved masks replace the current ones rather than adding to them
+    board->enableAllChannels();
+
+    forEachXmlChildElementWithTagName (*xml, channelMask, "CHANNELMASK")
+    {
+        int hsNum = channelMask->getIntAttribute ("headstage", -1);
+        StringArray disabledChannels = StringArray::fromTokens (channelMask->getStringAttribute ("disabled"), ",", "");
+
+        for (auto& ch : disabledChannels)
+            board->setChannelEnabled (hsNum, ch.getIntValue(), false);
+    }
 
     int AudioOutputL = xml->getIntAttribute ("AudioOutputL", -1);
     int AudioOutputR = xml->getIntAttribute ("AudioOutputR", -1);
@@ -1066,3 +1142,188 @@ void DSPInterface::paint (Graphics& g)
     g.setColour (findColour (ThemeColours::defaultText));
     g.setFont (FontOptions ("Inter", "Regular", 10.0f));
 }
+
+// USB transfer options --------------------------------------------------------------------
+
+UsbInterface::UsbInterface (DeviceThread* board_,
+                            DeviceEditor* editor_) : name ("USB"), lastLatencyString ("10"), board (board_), editor (editor_)
+{
+    blockOptions = { 0, 1, 2, 4, 8, 16 };
+    chunkOptions = { 8, 16, 32 };
+
+    blocksSelection = std::make_unique<ComboBox> ("USB Blocks");
+    blocksSelection->addItem ("Auto", 1);
+    for (int i = 1; i < blockOptions.size(); i++)
+        blocksSelection->addItem (String (blockOptions[i]), i + 1);
+    blocksSelection->setSelectedId (1, dontSendNotification);
+    blocksSelection->setTooltip ("Data blocks per USB transfer, or the maximum in adaptive mode (Auto = based on sample rate)");
+    blocksSelection->addListener (this);
+    blocksSelection->setBounds (0, 14, 65, 18);
+    addAndMakeVisible (blocksSelection.get());
+
+    modeSelection = std::make_unique<ComboBox> ("USB Mode");
+    modeSelection->addItem ("Fixed", FIXED_TRANSFERS);
+    modeSelection->addItem ("Adaptive", ADAPTIVE_TRANSFERS);
+    modeSelection->addItem ("Low latency", LOW_LATENCY_TRANSFERS);
+    modeSelection->setSelectedId (FIXED_TRANSFERS, dontSendNotification);
+    modeSelection->setTooltip ("Adaptive: read single blocks while the board FIFO is nearly empty, larger transfers when data backs up. "
+                               "Low latency: read and process chunks of a few samples, for closed-loop experiments");
+    modeSelection->addListener (this);
+    modeSelection->setBounds (0, 50, 65, 18);
+    addAndMakeVisible (modeSelection.get());
+
+    latencySelection = std::make_unique<Label> ("USB Latency", lastLatencyString);
+    latencySelection->setEditable (true, false, false);
+    latencySelection->setTooltip ("FIFO backlog (ms) above which adaptive transfers grow");
+    latencySelection->addListener (this);
+    latencySelection->setBounds (0, 86, 35, 18);
+    addAndMakeVisible (latencySelection.get());
+
+    chunkSelection = std::make_unique<ComboBox> ("USB Chunk");
+    for (int i = 0; i < chunkOptions.size(); i++)
+        chunkSelection->addItem (String (chunkOptions[i]), i + 1);
+    chunkSelection->setSelectedId (chunkOptions.indexOf (16) + 1, dontSendNotification);
+    chunkSelection->setTooltip ("Samples per chunk in low latency mode");
+    chunkSelection->addListener (this);
+    chunkSelection->setBounds (0, 86, 65, 18);
+    addChildComponent (chunkSelection.get());
+
+    updateControls();
+}
+
+UsbInterface::~UsbInterface()
+{
+}
+
+void UsbInterface::comboBoxChanged (ComboBox* cb)
+{
+    if (cb == blocksSelection.get())
+    {
+        board->setUsbBlocksPerRead (blockOptions[cb->getSelectedId() - 1]);
+
+        LOGD ("Setting USB blocks per transfer to ", board->getEffectiveUsbBlocksPerRead());
+    }
+    else if (cb == modeSelection.get())
+    {
+        board->setUsbTransferMode (UsbTransferMode (cb->getSelectedId()));
+        updateControls();
+
+        LOGD ("Setting USB transfer mode to ", cb->getText());
+    }
+    else if (cb == chunkSelection.get())
+    {
+        board->setLowLatencyChunkSize (chunkOptions[cb->getSelectedId() - 1]);
+
+        LOGD ("Setting low latency chunk size to ", board->getLowLatencyChunkSize(), " samples");
+    }
+}
+
+void UsbInterface::labelTextChanged (Label* label)
+{
+    if (label == latencySelection.get())
+    {
+        Value val = label->getTextValue();
+        float requestedValue = float (val.getValue());
+
+        if (requestedValue <= 0.0f || requestedValue > 1000.0f)
+        {
+            CoreServices::sendStatusMessage ("Value must be between 0 and 1000 ms.");
+            label->setText (lastLatencyString, dontSendNotification);
+            return;
+        }
+
+        board->setUsbTargetLatency (requestedValue);
+        lastLatencyString = String (board->getUsbTargetLatency());
+
+        LOGD ("Setting USB target latency to ", lastLatencyString, " ms");
+        label->setText (lastLatencyString, dontSendNotification);
+    }
+}
+
+void UsbInterface::setControlsEnabled (bool enabled)
+{
+    controlsEnabled = enabled;
+    updateControls();
+}
+
+void UsbInterface::updateControls()
+{
+    UsbTransferMode mode = board->getUsbTransferMode();
+
+    blocksSelection->setEnabled (controlsEnabled && mode != LOW_LATENCY_TRANSFERS);
+    modeSelection->setEnabled (controlsEnabled);
+    latencySelection->setEnabled (controlsEnabled && mode == ADAPTIVE_TRANSFERS);
+    chunkSelection->setEnabled (controlsEnabled);
+
+    latencySelection->setVisible (mode != LOW_LATENCY_TRANSFERS);
+    chunkSelection->setVisible (mode == LOW_LATENCY_TRANSFERS);
+
+    repaint();
+}
+
+int UsbInterface::getBlocksPerRead() const
+{
+    return board->getUsbBlocksPerRead();
+}
+
+void UsbInterface::setBlocksPerRead (int numBlocks)
+{
+    int index = blockOptions.indexOf (numBlocks);
+
+    blocksSelection->setSelectedId (index >= 0 ? index + 1 : 1, sendNotificationSync);
+}
+
+int UsbInterface::getTransferMode() const
+{
+    return board->getUsbTransferMode();
+}
+
+void UsbInterface::setTransferMode (int mode)
+{
+    if (mode < FIXED_TRANSFERS || mode > LOW_LATENCY_TRANSFERS)
+        mode = FIXED_TRANSFERS;
+
+    modeSelection->setSelectedId (mode, sendNotificationSync);
+}
+
+float UsbInterface::getTargetLatency() const
+{
+    return board->getUsbTargetLatency();
+}
+
+void UsbInterface::setTargetLatency (float latencyMs)
+{
+    board->setUsbTargetLatency (latencyMs);
+    lastLatencyString = String (board->getUsbTargetLatency());
+    latencySelection->setText (lastLatencyString, dontSendNotification);
+}
+
+int UsbInterface::getChunkSize() const
+{
+    return board->getLowLatencyChunkSize();
+}
+
+void UsbInterface::setChunkSize (int numSamples)
+{
+    int index = chunkOptions.indexOf (numSamples);
+
+    chunkSelection->setSelectedId (index >= 0 ? index + 1 : chunkOptions.indexOf (16) + 1, sendNotificationSync);
+}
+
+void UsbInterface::paint (Graphics& g)
+{
+    g.setColour (findColour (ThemeColours::defaultText));
+    g.setFont (FontOptions ("Inter", "Regular", 10.0f));
+    g.drawText (name + " blocks", 0, 0, 70, 15, Justification::left, false);
+    g.drawText ("Mode", 0, 36, 70, 15, Justification::left, false);
+
+    if (board->getUsbTransferMode() == LOW_LATENCY_TRANSFERS)
+    {
+        g.drawText ("Chunk samples", 0, 72, 70, 15, Justification::left, false);
+    }
+    else
+    {
+        g.drawText ("Latency", 0, 72, 70, 15, Justification::left, false);
+        g.drawText ("ms", 38, 86, 30, 18, Justification::left, false);
+    }
+}
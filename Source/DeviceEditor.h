@@ -35,6 +35,7 @@ class BandwidthInterface;
 class DSPInterface;
 class AudioInterface;
 class ClockDivideInterface;
+class UsbInterface;
 class DeviceThread;
 class ChannelCanvas;
 
@@ -104,6 +105,7 @@ private:
 
     std::unique_ptr<AudioInterface> audioInterface;
     std::unique_ptr<ClockDivideInterface> clockInterface;
+    std::unique_ptr<UsbInterface> usbInterface;
 
     std::unique_ptr<UtilityButton> rescanButton, dacTTLButton;
     std::unique_ptr<UtilityButton> auxButton;
@@ -307,5 +309,55 @@ private:
     int actualDivideRatio;
 };
 
+class UsbInterface : public Component,
+                     public ComboBox::Listener,
+                     public Label::Listener
+{
+public:
+    UsbInterface (DeviceThread*, DeviceEditor*);
+    ~UsbInterface();
+
+    void paint (Graphics& g);
+    void comboBoxChanged (ComboBox* cb);
+    void labelTextChanged (Label* te);
+
+    /** Enables or disables the controls (disabled during acquisition) */
+    void setControlsEnabled (bool enabled);
+
+    /** Returns the number of blocks per transfer (0 = automatic) */
+    int getBlocksPerRead() const;
+    void setBlocksPerRead (int numBlocks);
+
+    /** Returns the USB transfer mode (see UsbTransferMode) */
+    int getTransferMode() const;
+    void setTransferMode (int mode);
+
+    /** Target latency for adaptive transfers, in ms */
+    float getTargetLatency() const;
+    void setTargetLatency (float latencyMs);
+
+    /** Samples per chunk in low latency mode */
+    int getChunkSize() const;
+    void setChunkSize (int numSamples);
+
+private:
+    /** Shows and enables the controls that apply to the current mode */
+    void updateControls();
+
+    String name;
+    String lastLatencyString;
+
+    DeviceThread* board;
+    DeviceEditor* editor;
+
+    std::unique_ptr<ComboBox> blocksSelection;
+    std::unique_ptr<ComboBox> modeSelection;
+    std::unique_ptr<Label> latencySelection;
+    std::unique_ptr<ComboBox> chunkSelection;
+    Array<int> blockOptions;
+    Array<int> chunkOptions;
+    bool controlsEnabled = true;
+};
+
 } // namespace RhythmNode
 #endif // __DEVICEEDITOR_H_2AD3C591__
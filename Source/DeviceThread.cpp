@@ -26,10 +26,14 @@
 #endif
 
 #include "DeviceThread.h"
+#include "DecodeThreadPool.h"
 #include "DeviceEditor.h"
+#include "EmulatorBoard.h"
 
 #include "Headstage.h"
 #include "ImpedanceMeter.h"
+#include "RawFrameRecorder.h"
+#include "ReplayBoard.h"
 
 #include "USBThread.h"
 
@@ -65,9 +69,6 @@ DeviceThread::DeviceThread (SourceNode* sn) : DataThread (sn),
 {
     impedanceThread = std::make_unique<ImpedanceMeter> (this);
 
-    memset (auxBuffer, 0, sizeof (auxBuffer));
-    memset (auxSamples, 0, sizeof (auxSamples));
-
     for (int i = 0; i < 8; i++)
         adcRangeSettings[i] = 0;
 
@@ -76,9 +77,10 @@ DeviceThread::DeviceThread (SourceNode* sn) : DataThread (sn),
     for (int i = 0; i < maxNumHeadstages; i++)
         headstages.add (new Headstage (i, maxNumHeadstages));
 
-    evalBoard = std::make_unique<Rhd2000EvalBoardUsb3>();
+    evalBoard = createBoard();
 
     sourceBuffers.add (new DataBuffer (2, 10000)); // start with 2 channels and automatically resize
+    sourceBuffers.add (new DataBuffer (3, 2500)); // quarter-rate aux inputs
 
     // Open Opal Kelly XEM6010 board.
     // Returns 1 if successful, -1 if FrontPanel cannot be loaded, and -2 if XEM6010 can't be found.
@@ -179,6 +181,7 @@ void DeviceThread::handleBroadcastMessage (const String& msg, const int64 messag
                     DigitalOutputCommand command;
                     command.ttlLine = ttlLine;
                     command.state = true;
+                    command.requestTicks = Time::getHighResolutionTicks();
 
                     digitalOutputCommands.push (command);
 
@@ -230,6 +233,9 @@ void DeviceThread::setDACchannel (int dacOutput, int channel)
 {
     if (channel < getNumDataOutputs (ContinuousChannel::ELECTRODE))
     {
+        // the editor counts the published channels, the DACs the active channels of each stream
+        channel = getActiveChannelIndex (channel);
+
         int channelCount = 0;
         for (int i = 0; i < enabledStreams.size(); i++)
         {
@@ -261,6 +267,83 @@ Array<int> DeviceThread::getDACchannels() const
     return dacChannelsArray;
 }
 
+/** Sample rates selectable with setSampleRate(), by index */
+static const float boardSampleRates[] = { 1000.0f, 1250.0f, 1500.0f, 2000.0f, 2500.0f, 3000.0f, 3333.0f, 4000.0f, 5000.0f,
+                                          6250.0f, 8000.0f, 10000.0f, 12500.0f, 15000.0f, 20000.0f, 25000.0f, 30000.0f };
+
+/** Returns the index of the selectable sample rate closest to rate */
+static int getSampleRateIndex (double rate)
+{
+    int best = 0;
+
+    for (int i = 1; i < numElementsInArray (boardSampleRates); i++)
+    {
+        if (std::abs (boardSampleRates[i] - rate) < std::abs (boardSampleRates[best] - rate))
+            best = i;
+    }
+
+    return best;
+}
+
+std::unique_ptr<Rhd2000EvalBoardUsb3> DeviceThread::createBoard()
+{
+    const String emulatedHeadstages = SystemStats::getEnvironmentVariable ("RHYTHM_EMULATE", String());
+    const String replayPath = SystemStats::getEnvironmentVariable ("RHYTHM_REPLAY_FILE", String());
+
+    if (emulatedHeadstages.isNotEmpty() && replayPath.isEmpty())
+    {
+        const bool realTime = SystemStats::getEnvironmentVariable ("RHYTHM_EMULATE_SPEED", "realtime") != "max";
+
+        auto board = std::make_unique<EmulatorBoard> (realTime);
+
+        if (! board->setHeadstages (emulatedHeadstages.toStdString()))
+        {
+            LOGE ("Could not parse RHYTHM_EMULATE=", emulatedHeadstages, " (expected e.g. A1:RHD2164,B1:RHD2132), opening the acquisition board instead");
+            return std::make_unique<Rhd2000EvalBoardUsb3>();
+        }
+
+        LOGC ("Emulating ", board->getNumChannels(), " channels on headstages ", emulatedHeadstages, realTime ? " in real time" : " at full speed");
+
+        return board;
+    }
+
+    if (replayPath.isEmpty())
+        return std::make_unique<Rhd2000EvalBoardUsb3>();
+
+    // either the .dat or the .xml file of a raw frame recording can be given
+    const File headerFile = File (replayPath).withFileExtension ("xml");
+    replayLayout = parseXML (headerFile);
+
+    if (replayLayout == nullptr || ! replayLayout->hasTagName ("RHYTHM_RAW_FRAMES"))
+    {
+        LOGE ("No raw frame header at ", headerFile.getFullPathName(), ", opening the acquisition board instead");
+        replayLayout = nullptr;
+        return std::make_unique<Rhd2000EvalBoardUsb3>();
+    }
+
+    const File dataFile = headerFile.getSiblingFile (replayLayout->getStringAttribute ("data_file"));
+    const int sampleRateIndex = getSampleRateIndex (replayLayout->getDoubleAttribute ("sample_rate"));
+    const bool realTime = SystemStats::getEnvironmentVariable ("RHYTHM_REPLAY_SPEED", "realtime") != "max";
+    const bool loop = SystemStats::getEnvironmentVariable ("RHYTHM_REPLAY_LOOP", "0") == "1";
+
+    auto board = std::make_unique<ReplayBoard> (dataFile.getFullPathName().toStdString(),
+                                                replayLayout->getIntAttribute ("num_streams"),
+                                                (Rhd2000EvalBoardUsb3::AmplifierSampleRate) sampleRateIndex,
+                                                realTime,
+                                                loop);
+
+    if (! board->isOpen())
+    {
+        LOGE ("Could not replay ", dataFile.getFullPathName(), ", opening the acquisition board instead");
+        replayLayout = nullptr;
+        return std::make_unique<Rhd2000EvalBoardUsb3>();
+    }
+
+    LOGC ("Replaying ", board->getNumFileFrames(), " frames from ", dataFile.getFullPathName(), realTime ? " in real time" : " at full speed", loop ? ", looped" : "");
+
+    return board;
+}
+
 bool DeviceThread::openBoard (String pathToLibrary)
 {
     okBoardType = evalBoard->open();
@@ -448,6 +531,12 @@ void DeviceThread::scanPorts()
         return;
     }
 
+    if (replayLayout != nullptr)
+    {
+        scanReplayStreams();
+        return;
+    }
+
     impedanceThread->stopThreadSafely();
 
     //Clear previous known streams
@@ -698,6 +787,77 @@ void DeviceThread::scanPorts()
     //newScan = true;
 }
 
+void DeviceThread::scanReplayStreams()
+{
+    impedanceThread->stopThreadSafely();
+
+    enabledStreams.clear();
+    numChannelsPerDataStream.clear();
+    chipId.clearQuick();
+
+    for (auto headstage : headstages)
+        headstage->setNumStreams (0);
+
+    // the recording lists its streams in frame order, which is also headstage order
+    for (int hs = 0; hs < headstages.size(); hs++)
+    {
+        Array<XmlElement*> streams;
+
+        forEachXmlChildElementWithTagName (*replayLayout, streamXml, "STREAM")
+        {
+            if (streamXml->getIntAttribute ("board_stream") / 2 == hs)
+                streams.add (streamXml);
+        }
+
+        if (streams.isEmpty())
+        {
+            enableHeadstage (hs, false);
+            continue;
+        }
+
+        const int id = streams[0]->getIntAttribute ("chip_id");
+        const int numChannels = streams[0]->getIntAttribute ("channels");
+
+        // restore the channels that were switched off during the recording
+        for (int offset = 0; offset < streams.size(); offset++)
+        {
+            const uint32 mask = (uint32) streams[offset]->getStringAttribute ("channel_mask", "0xffffffff").getHexValue32();
+
+            for (int ch = 0; ch < numChannels; ch++)
+                headstages[hs]->setChannelEnabled (offset * numChannels + ch, (mask >> ch) & 1);
+        }
+
+        if (id == CHIP_ID_RHD2164 && streams.size() > 1)
+        {
+            chipId.add (CHIP_ID_RHD2164);
+            chipId.add (CHIP_ID_RHD2164_B);
+            enableHeadstage (hs, true, 2, 32);
+        }
+        else
+        {
+            chipId.add (id);
+            enableHeadstage (hs, true, 1, id == CHIP_ID_RHD2132 ? 32 : 16);
+
+            if (id == CHIP_ID_RHD2132 && numChannels == 16)
+                setNumChannels (hs, 16);
+        }
+    }
+
+    updateBoardStreams();
+
+    LOGD ("Replaying ", evalBoard->getNumEnabledDataStreams(), " data streams");
+
+    setSampleRate (getSampleRateIndex (replayLayout->getDoubleAttribute ("sample_rate")));
+}
+
+Array<int> DeviceThread::getStreamLayout() const
+{
+    Array<int> layout (enabledStreams);
+    layout.addArray (chipId);
+
+    return layout;
+}
+
 int DeviceThread::getDeviceId (Rhd2000DataBlockUsb3* dataBlock, int stream, int& register59Value)
 {
     bool intanChipPresent;
@@ -744,18 +904,25 @@ void DeviceThread::updateSettings (OwnedArray<ContinuousChannel>* continuousChan
     // create device
     // CODE GOES HERE
 
-    DataStream::Settings dataStreamSettings {
-        "Rhythm Data",
-        "Continuous and event data from a device running Rhythm FPGA firmware",
-        "rhythm-fpga-device.data",
+    const bool perHeadstage = usesStreamPerHeadstage();
 
-        static_cast<float> (evalBoard->getSampleRate())
+    DataStream* stream = nullptr;
 
-    };
+    if (! perHeadstage)
+    {
+        DataStream::Settings dataStreamSettings {
+            "Rhythm Data",
+            "Continuous and event data from a device running Rhythm FPGA firmware",
+            "rhythm-fpga-device.data",
 
-    DataStream* stream = new DataStream (dataStreamSettings);
+            static_cast<float> (evalBoard->getSampleRate())
 
-    sourceStreams->add (stream);
+        };
+
+        stream = new DataStream (dataStreamSettings);
+
+        sourceStreams->add (stream);
+    }
 
     int hsIndex = -1;
 
@@ -765,11 +932,31 @@ void DeviceThread::updateSettings (OwnedArray<ContinuousChannel>* continuousChan
 
         if (headstage->isConnected())
         {
+            // all streams share the board's sample clock and sample numbers
+            if (perHeadstage && hasHeadstageStream (headstage))
+            {
+                DataStream::Settings headstageStreamSettings {
+                    "Rhythm " + headstage->getStreamPrefix(),
+                    "Continuous data from one headstage of a device running Rhythm FPGA firmware",
+                    "rhythm-fpga-device.data." + headstage->getStreamPrefix(),
+
+                    static_cast<float> (evalBoard->getSampleRate())
+
+                };
+
+                stream = new DataStream (headstageStreamSettings);
+
+                sourceStreams->add (stream);
+            }
+
             for (int ch = 0; ch < headstage->getNumChannels(); ch++)
             {
                 if (headstage->getHalfChannels() && ch >= 16)
                     continue;
 
+                if (! headstage->isChannelEnabled (ch))
+                    continue;
+
                 ContinuousChannel::Settings channelSettings {
                     ContinuousChannel::ELECTRODE,
                     headstage->getChannelName (ch),
@@ -793,38 +980,24 @@ void DeviceThread::updateSettings (OwnedArray<ContinuousChannel>* continuousChan
         }
     }
 
-    if (settings.acquireAux)
+    if (settings.acquireAdc)
     {
-        int hsIndex = -1;
-
-        for (auto headstage : headstages)
+        if (perHeadstage)
         {
-            hsIndex++;
+            DataStream::Settings adcStreamSettings {
+                "Rhythm ADC",
+                "Board ADC inputs from a device running Rhythm FPGA firmware",
+                "rhythm-fpga-device.data.adc",
 
-            if (headstage->isConnected())
-            {
-                for (int ch = 0; ch < 3; ch++)
-                {
-                    ContinuousChannel::Settings channelSettings {
-                        ContinuousChannel::AUX,
-                        headstage->getStreamPrefix() + "_AUX" + String (ch + 1),
-                        "Aux input channel from a Rhythm FPGA device",
-                        "rhythm-fpga-device.continuous.aux",
+                static_cast<float> (evalBoard->getSampleRate())
 
-                        0.0000374,
+            };
 
-                        stream
-                    };
+            stream = new DataStream (adcStreamSettings);
 
-                    continuousChannels->add (new ContinuousChannel (channelSettings));
-                    continuousChannels->getLast()->setUnits ("mV");
-                }
-            }
+            sourceStreams->add (stream);
         }
-    }
 
-    if (settings.acquireAdc)
-    {
         for (int ch = 0; ch < 8; ch++)
         {
             String name = "ADC" + String (ch + 1);
@@ -850,11 +1023,51 @@ void DeviceThread::updateSettings (OwnedArray<ContinuousChannel>* continuousChan
         "Rhythm FPGA TTL Input",
         "Events on digital input lines of a Rhythm FPGA device",
         "rhythm-fpga-device.events",
-        stream,
+        sourceStreams->getFirst(),
         8
     };
 
     eventChannels->add (new EventChannel (settings));
+
+    // aux inputs are only sampled every 4th frame, so they get their own stream at a quarter of the rate
+    if (getNumDataOutputs (ContinuousChannel::AUX) > 0)
+    {
+        DataStream::Settings auxStreamSettings {
+            "Rhythm Aux",
+            "Headstage aux inputs from a device running Rhythm FPGA firmware",
+            "rhythm-fpga-device.aux",
+
+            static_cast<float> (evalBoard->getSampleRate() / 4)
+
+        };
+
+        DataStream* auxStream = new DataStream (auxStreamSettings);
+
+        sourceStreams->add (auxStream);
+
+        for (auto headstage : headstages)
+        {
+            if (headstage->isConnected())
+            {
+                for (int ch = 0; ch < 3; ch++)
+                {
+                    ContinuousChannel::Settings channelSettings {
+                        ContinuousChannel::AUX,
+                        headstage->getStreamPrefix() + "_AUX" + String (ch + 1),
+                        "Aux input channel from a Rhythm FPGA device",
+                        "rhythm-fpga-device.continuous.aux",
+
+                        0.0000374,
+
+                        auxStream
+                    };
+
+                    continuousChannels->add (new ContinuousChannel (channelSettings));
+                    continuousChannels->getLast()->setUnits ("mV");
+                }
+            }
+        }
+    }
 }
 
 void DeviceThread::impedanceMeasurementFinished()
@@ -881,6 +1094,8 @@ void DeviceThread::saveImpedances (File& file)
     {
         std::unique_ptr<XmlElement> xml = std::unique_ptr<XmlElement> (new XmlElement ("IMPEDANCES"));
 
+        xml->setAttribute ("frequency", impedances.primaryFrequency);
+
         int globalChannelNumber = -1;
 
         for (auto hs : headstages)
@@ -897,6 +1112,19 @@ void DeviceThread::saveImpedances (File& file)
                 channelXml->setAttribute ("number", globalChannelNumber);
                 channelXml->setAttribute ("magnitude", hs->getImpedanceMagnitude (ch));
                 channelXml->setAttribute ("phase", hs->getImpedancePhase (ch));
+
+                if (impedances.frequencies.size() > 1)
+                {
+                    for (int f = 0; f < impedances.frequencies.size(); f++)
+                    {
+                        XmlElement* sweepXml = new XmlElement ("SWEEP");
+                        sweepXml->setAttribute ("frequency", impedances.frequencies[f]);
+                        sweepXml->setAttribute ("magnitude", hs->getImpedanceMagnitude (ch, f));
+                        sweepXml->setAttribute ("phase", hs->getImpedancePhase (ch, f));
+                        channelXml->addChildElement (sweepXml);
+                    }
+                }
+
                 headstageXml->addChildElement (channelXml);
             }
 
@@ -971,6 +1199,54 @@ int DeviceThread::getNumChannels()
     return totalChannels;
 }
 
+bool DeviceThread::usesStreamPerHeadstage()
+{
+    // with no headstage channels, the ADCs are the only stream either way
+    return settings.streamPerHeadstage && getNumDataOutputs (ContinuousChannel::ELECTRODE) > 0;
+}
+
+bool DeviceThread::hasHeadstageStream (const Headstage* headstage)
+{
+    return headstage->isConnected() && headstage->getNumEnabledChannels() > 0;
+}
+
+Array<int> DeviceThread::getStreamChannelCounts()
+{
+    Array<int> channelCounts;
+
+    if (! usesStreamPerHeadstage())
+    {
+        channelCounts.add (getNumDataOutputs (ContinuousChannel::ELECTRODE) + getNumDataOutputs (ContinuousChannel::ADC));
+        return channelCounts;
+    }
+
+    for (auto headstage : headstages)
+    {
+        if (hasHeadstageStream (headstage))
+            channelCounts.add (headstage->getNumEnabledChannels());
+    }
+
+    if (settings.acquireAdc)
+        channelCounts.add (getNumDataOutputs (ContinuousChannel::ADC));
+
+    return channelCounts;
+}
+
+void DeviceThread::resizeSourceBuffers()
+{
+    Array<int> channelCounts = getStreamChannelCounts();
+
+    // buffers follow the DataStream order: the full-rate streams, then aux
+    while (sourceBuffers.size() < channelCounts.size() + 1)
+        sourceBuffers.add (new DataBuffer (2, 10000));
+
+    for (int i = 0; i < channelCounts.size(); i++)
+        sourceBuffers[i]->resize (channelCounts[i], 10000);
+
+    auxBufferIndex = channelCounts.size();
+    sourceBuffers[auxBufferIndex]->resize (getNumDataOutputs (ContinuousChannel::AUX), 2500);
+}
+
 int DeviceThread::getNumDataOutputs (ContinuousChannel::Type type)
 {
     if (type == ContinuousChannel::ELECTRODE)
@@ -981,7 +1257,7 @@ int DeviceThread::getNumDataOutputs (ContinuousChannel::Type type)
         {
             if (headstage->isConnected())
             {
-                totalChannels += headstage->getNumActiveChannels();
+                totalChannels += headstage->getNumEnabledChannels();
             }
         }
 
@@ -1131,7 +1407,16 @@ bool DeviceThread::enableHeadstage (int hsNum, bool enabled, int nStr, int strCh
 
     if (enabled)
     {
-        headstages[hsNum]->setFirstChannel (getNumDataOutputs (ContinuousChannel::ELECTRODE));
+        // channel names count disabled channels too, so they stay tied to the electrode sites
+        int firstChannel = 0;
+
+        for (auto headstage : headstages)
+        {
+            if (headstage->isConnected())
+                firstChannel += headstage->getNumActiveChannels();
+        }
+
+        headstages[hsNum]->setFirstChannel (firstChannel);
         headstages[hsNum]->setNumStreams (nStr);
         headstages[hsNum]->setChannelsPerStream (strChans);
         headstages[hsNum]->setFirstStreamIndex (enabledStreams.size());
@@ -1167,7 +1452,7 @@ bool DeviceThread::enableHeadstage (int hsNum, bool enabled, int nStr, int strCh
         headstages[hsNum]->setNumStreams (0);
     }
 
-    sourceBuffers[0]->resize (getNumChannels(), 10000);
+    resizeSourceBuffers();
 
     return true;
 }
@@ -1227,14 +1512,14 @@ int DeviceThread::getChannelsInHeadstage (int hsNum) const
 void DeviceThread::enableAuxs (bool t)
 {
     settings.acquireAux = t;
-    sourceBuffers[0]->resize (getNumChannels(), 10000);
+    resizeSourceBuffers();
     updateRegisters();
 }
 
 void DeviceThread::enableAdcs (bool t)
 {
     settings.acquireAdc = t;
-    sourceBuffers[0]->resize (getNumChannels(), 10000);
+    resizeSourceBuffers();
 }
 
 bool DeviceThread::isAuxEnabled()
@@ -1245,12 +1530,18 @@ bool DeviceThread::isAuxEnabled()
 void DeviceThread::setSampleRate (int sampleRateIndex, bool isTemporary)
 {
     impedanceThread->stopThreadSafely();
+
+    // a replayed recording plays at the rate it was captured at
+    if (replayLayout != nullptr)
+        sampleRateIndex = getSampleRateIndex (replayLayout->getDoubleAttribute ("sample_rate"));
+
     if (! isTemporary)
     {
         settings.savedSampleRateIndex = sampleRateIndex;
     }
 
-    int numUsbBlocksToRead = 0; // placeholder - make this change the number of blocks that are read in DeviceThread::updateBuffer()
+    // number of data blocks requested per USB transfer, scaled so higher rates need fewer transfers per second
+    int numUsbBlocksToRead = 0;
 
     Rhd2000EvalBoardUsb3::AmplifierSampleRate sampleRate; // just for local use
 
@@ -1347,6 +1638,8 @@ void DeviceThread::setSampleRate (int sampleRateIndex, bool isTemporary)
             settings.boardSampleRate = 10000.0f;
     }
 
+    settings.numUsbBlocksToRead = numUsbBlocksToRead;
+
     // Select per-channel amplifier sampling rate.
     evalBoard->setSampleRate (sampleRate);
 
@@ -1440,14 +1733,61 @@ void DeviceThread::updateRegisters()
     evalBoard->selectAuxCommandLength (Rhd2000EvalBoardUsb3::AuxCmd3, 0, commandSequenceLength - 1);
 
     chipRegisters.setFastSettle (false);
-    evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortA, Rhd2000EvalBoardUsb3::AuxCmd3, settings.fastSettleEnabled ? 2 : 1);
-    evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortB, Rhd2000EvalBoardUsb3::AuxCmd3, settings.fastSettleEnabled ? 2 : 1);
-    evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortC, Rhd2000EvalBoardUsb3::AuxCmd3, settings.fastSettleEnabled ? 2 : 1);
-    evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortD, Rhd2000EvalBoardUsb3::AuxCmd3, settings.fastSettleEnabled ? 2 : 1);
-    evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortE, Rhd2000EvalBoardUsb3::AuxCmd3, settings.fastSettleEnabled ? 2 : 1);
-    evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortF, Rhd2000EvalBoardUsb3::AuxCmd3, settings.fastSettleEnabled ? 2 : 1);
-    evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortG, Rhd2000EvalBoardUsb3::AuxCmd3, settings.fastSettleEnabled ? 2 : 1);
-    evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortH, Rhd2000EvalBoardUsb3::AuxCmd3, settings.fastSettleEnabled ? 2 : 1);
+
+    // Ports with powered-down amplifiers get their own config in AuxCmd3 RAM banks 8-15
+    // (bank 3 is used by the impedance test). Both headstages on a port receive the port's
+    // commands, so an amplifier is only switched off if no headstage there uses it.
+    for (int port = 0; port < 8; port++)
+    {
+        portConfigBanks[port] = settings.fastSettleEnabled ? 2 : 1;
+
+        if (! settings.powerDownDisabledAmps)
+            continue;
+
+        std::array<int, 64> ampUse {}; // 0 = not an active channel, 1 = disabled, 2 = enabled
+
+        for (int hsNum = 2 * port; hsNum < 2 * port + 2 && hsNum < headstages.size(); hsNum++)
+        {
+            const Headstage* headstage = headstages[hsNum];
+
+            if (! headstage->isConnected())
+                continue;
+
+            for (int ch = 0; ch < headstage->getNumActiveChannels(); ch++)
+            {
+                int chipChannel = headstage->getChipChannel (ch);
+
+                if (chipChannel < 64)
+                    ampUse[chipChannel] = headstage->isChannelEnabled (ch) ? 2 : jmax (ampUse[chipChannel], 1);
+            }
+        }
+
+        int numPoweredDown = 0;
+
+        for (int chipChannel = 0; chipChannel < 64; chipChannel++)
+        {
+            if (ampUse[chipChannel] == 1)
+            {
+                chipRegisters.setAmpPowered (chipChannel, false);
+                numPoweredDown++;
+            }
+        }
+
+        if (numPoweredDown > 0)
+        {
+            chipRegisters.setFastSettle (settings.fastSettleEnabled);
+            commandSequenceLength = chipRegisters.createCommandListRegisterConfig (commandList, false);
+            evalBoard->uploadCommandList (commandList, Rhd2000EvalBoardUsb3::AuxCmd3, 8 + port);
+            chipRegisters.setFastSettle (false);
+            chipRegisters.powerUpAllAmps();
+
+            portConfigBanks[port] = 8 + port;
+
+            LOGD ("Powering down ", numPoweredDown, " amplifiers on port ", port);
+        }
+    }
+
+    selectRegisterConfigBanks();
 }
 
 void DeviceThread::setCableLength (int hsNum, float length)
@@ -1495,6 +1835,70 @@ bool DeviceThread::startAcquisition()
 
     LOGD ("Expecting ", getNumChannels(), " channels.");
 
+    // resolve the channel layout once, so the decoder does not branch on it per sample
+    int numHeadstageGroups = 0;
+
+    for (auto headstage : headstages)
+    {
+        if (hasHeadstageStream (headstage))
+            numHeadstageGroups++;
+    }
+
+    std::vector<DecodePlan::StreamLayout> streamLayouts;
+    for (int i = 0; i < enabledStreams.size(); i++)
+    {
+        int nChans = numChannelsPerDataStream[i];
+        bool is16ChannelRhd2132 = (chipId[i] == CHIP_ID_RHD2132) && (nChans == 16);
+
+        // with a stream per headstage, each headstage with a stream of its own forms one output
+        // group; a headstage with every channel disabled adds nothing, so its data streams join
+        // the next group (or the last one) to keep each group's streams contiguous
+        int group = 0;
+        uint32 channelMask = 0xFFFFFFFF;
+        int headstageGroup = 0;
+
+        for (auto headstage : headstages)
+        {
+            if (! headstage->isConnected())
+                continue;
+
+            for (int offset = 0; offset < headstage->getNumStreams(); offset++)
+            {
+                if (headstage->getDataStream (offset) == enabledStreams[i])
+                {
+                    group = usesStreamPerHeadstage() ? jmin (headstageGroup, numHeadstageGroups - 1) : 0;
+                    channelMask = headstage->getStreamChannelMask (offset);
+                }
+            }
+
+            if (hasHeadstageStream (headstage))
+                headstageGroup++;
+        }
+
+        streamLayouts.push_back ({ nChans,
+                                   is16ChannelRhd2132 ? RHD2132_16CH_OFFSET : 0,
+                                   chipId[i] != CHIP_ID_RHD2164_B,
+                                   group,
+                                   channelMask });
+    }
+
+    frameDecoder = std::make_unique<FrameDecoder> (DecodePlan (streamLayouts, settings.acquireAux, settings.acquireAdc, usesStreamPerHeadstage()));
+
+    const DecodePlan& plan = frameDecoder->getPlan();
+    Array<int> streamChannelCounts = getStreamChannelCounts();
+
+    bool layoutMatches = streamChannelCounts.size() == (int) plan.groups.size();
+
+    for (int g = 0; layoutMatches && g < (int) plan.groups.size(); g++)
+        layoutMatches = plan.groups[g].numChannels == streamChannelCounts[g];
+
+    if (! layoutMatches)
+    {
+        LOGE ("Rhythm decode layout does not match the data streams, not starting acquisition");
+        frameDecoder.reset();
+        return false;
+    }
+
     // reset TTL output state
     for (int k = 0; k < 16; k++)
     {
@@ -1507,8 +1911,105 @@ bool DeviceThread::startAcquisition()
     //LOGD("RHD2000 data thread starting acquisition.");
 
     blockSize = dataBlock->calculateDataBlockSizeInWords (evalBoard->getNumEnabledDataStreams());
+    frameBytes = 2 * dataBlock->calculateDataBlockSizeInWords (evalBoard->getNumEnabledDataStreams(), 1);
     evalBoard->flush();
-    usbThread->startAcquisition (blockSize * 2);
+    usbThread->setNumBuffers (settings.usbBufferCount);
+    usbThread->setBoardSampleRate (settings.boardSampleRate);
+
+    if (settings.usbTransferMode == ADAPTIVE_TRANSFERS)
+    {
+        // backlog, in FIFO words, that may sit on the board before reads grow to drain it
+        double targetSamples = settings.usbTargetLatencyMs * settings.boardSampleRate / 1000.0;
+        usbThread->setAdaptiveTransfers (true, (unsigned int) (targetSamples * frameBytes / 2));
+
+        LOGD ("Adaptive USB transfers: target latency ", settings.usbTargetLatencyMs, " ms, up to ", getEffectiveUsbBlocksPerRead(), " blocks per transfer");
+    }
+    else
+    {
+        usbThread->setAdaptiveTransfers (false, 0);
+    }
+
+    if (settings.usbTransferMode == LOW_LATENCY_TRANSFERS)
+    {
+        // transfers must be whole USB3 blocks, so round the chunk up; samples split
+        // across two transfers are reassembled in updateBuffer()
+        int chunkBytes = settings.lowLatencyChunkSamples * frameBytes;
+        int transferBytes = (chunkBytes + USB3_BLOCK_SIZE - 1) / USB3_BLOCK_SIZE * USB3_BLOCK_SIZE;
+        usbThread->setSubBlockTransfers (transferBytes);
+
+        LOGD ("Low latency USB transfers: ", transferBytes, " bytes (", (float) transferBytes / frameBytes, " samples) per transfer");
+    }
+    else
+    {
+        usbThread->setSubBlockTransfers (0);
+
+        if (settings.usbTransferMode == FIXED_TRANSFERS)
+            LOGD ("Reading ", getEffectiveUsbBlocksPerRead(), " blocks per USB transfer");
+    }
+
+    rawFrameRecorder.reset();
+
+    if (settings.rawFrameDirectory.isNotEmpty())
+    {
+        File directory (settings.rawFrameDirectory);
+        directory.createDirectory();
+
+        String fileName = "rhythm_frames_" + Time::getCurrentTime().formatted ("%Y-%m-%d_%H-%M-%S") + ".dat";
+        rawFrameRecorder = std::make_unique<RawFrameRecorder> (directory.getChildFile (fileName));
+
+        if (! rawFrameRecorder->isOpen())
+            rawFrameRecorder.reset();
+    }
+
+    usbThread->setRecorder (rawFrameRecorder.get());
+    usbThread->startAcquisition (blockSize * 2, getEffectiveUsbBlocksPerRead());
+
+    frameCarry.malloc (usbThread->getMaxTransferBytes() + frameBytes);
+    carryBytes = 0;
+
+    if (rawFrameRecorder != nullptr)
+        writeRawFrameHeader (rawFrameRecorder->getFile().withFileExtension ("xml"), streamLayouts);
+
+    LOGD ("Decoding ", frameDecoder->getPlan().numOutputChannels, " channels per sample, amplifier kernel: ", DecodeKernels::getLevelName (DecodeKernels::getBestLevel()));
+
+    if (settings.decodeThreads > 0)
+        decodePool = std::make_unique<DecodeThreadPool> (*frameDecoder, settings.decodeThreads, settings.decodeFirstCore);
+
+    // a transfer plus the partial sample carried over from the previous one
+    int maxBlockSamples = (usbThread->getMaxTransferBytes() + frameBytes) / frameBytes;
+    blockSamples.malloc ((size_t) maxBlockSamples * plan.numOutputChannels);
+    blockSampleNumbers.malloc (maxBlockSamples);
+    blockTimestamps.calloc (maxBlockSamples); // placeholder double timestamps
+    blockEventCodes.malloc (maxBlockSamples);
+    blockNoEventCodes.calloc (maxBlockSamples);
+
+    // each DataStream's samples are contiguous, so every stream gets its own sample-major block
+    groupSamples.clear();
+    float* groupStart = blockSamples;
+
+    for (const auto& group : plan.groups)
+    {
+        groupSamples.push_back (groupStart);
+        groupStart += (size_t) maxBlockSamples * group.numChannels;
+    }
+
+    runOutputs.resize (plan.groups.size());
+
+    // one aux sample per four frames, plus one for a run ending on a partial set
+    int maxAuxSamples = maxBlockSamples / 4 + 2;
+    auxSamples.malloc ((size_t) maxAuxSamples * jmax (1, frameDecoder->getPlan().numAuxChannels));
+    auxSampleNumbers.malloc (maxAuxSamples);
+    auxTimestamps.calloc (maxAuxSamples);
+    auxEventCodes.calloc (maxAuxSamples);
+
+    nextTimestamp = -1;
+    numResyncs = 0;
+    bytesSkipped = 0;
+    samplesLost = 0;
+    usbQueueLatency.reset();
+    decodeLatency.reset();
+    usbToBufferLatency.reset();
+    triggerLatency.reset();
     evalBoard->setContinuousRunMode (true);
     evalBoard->run();
 
@@ -1528,6 +2029,21 @@ bool DeviceThread::stopAcquisition()
     std::cout << "RHD2000 data thread stopping acquisition." << std::endl;
     usbThread->stopAcquisition();
 
+    if (rawFrameRecorder != nullptr)
+    {
+        usbThread->setRecorder (nullptr);
+        rawFrameRecorder->close();
+
+        LOGC ("Raw frames: ", rawFrameRecorder->getBytesWritten(), " bytes written to ", rawFrameRecorder->getFile().getFullPathName());
+
+        rawFrameRecorder.reset();
+    }
+
+    if (numResyncs > 0 || samplesLost > 0)
+        LOGC ("Rhythm frame resyncs: ", numResyncs, ", bytes skipped: ", bytesSkipped, ", samples lost: ", samplesLost);
+
+    LOGC (getLatencyReport());
+
     if (isThreadRunning())
     {
         signalThreadShouldExit();
@@ -1542,6 +2058,8 @@ bool DeviceThread::stopAcquisition()
         //LOGD("RHD2000 data thread failed to exit, continuing anyway...");
     }
 
+    decodePool.reset();
+
     if (deviceFound)
     {
         evalBoard->setContinuousRunMode (false);
@@ -1550,7 +2068,8 @@ bool DeviceThread::stopAcquisition()
         evalBoard->flush();
     }
 
-    sourceBuffers[0]->clear();
+    for (auto* buffer : sourceBuffers)
+        buffer->clear();
 
     isTransmitting = false;
     updateSettingsDuringAcquisition = false;
@@ -1565,6 +2084,23 @@ bool DeviceThread::stopAcquisition()
     return true;
 }
 
+int DeviceThread::findFrameHeader (unsigned char* buffer, int start, int numBytes) const
+{
+    for (int index = start + 1; index + 8 <= numBytes; index++)
+    {
+        if (! Rhd2000DataBlockUsb3::checkUsbHeader (buffer, index))
+            continue;
+
+        // the magic number could appear in sample data by chance, so also require a
+        // header one frame later when the buffer extends that far
+        int nextHeader = index + frameBytes;
+        if (nextHeader + 8 > numBytes || Rhd2000DataBlockUsb3::checkUsbHeader (buffer, nextHeader))
+            return index;
+    }
+
+    return -1;
+}
+
 bool DeviceThread::updateBuffer()
 {
     unsigned char* bufferPtr;
@@ -1575,104 +2111,128 @@ bool DeviceThread::updateBuffer()
     if (return_code == 0)
         return true;
 
+    const int64 arrivalTicks = usbThread->getArrivalTicks();
+    const int64 decodeStartTicks = Time::getHighResolutionTicks();
+    usbQueueLatency.addSample (Time::highResolutionTicksToSeconds (decodeStartTicks - arrivalTicks));
+
+    // a transfer need not end on a sample boundary (sub-block reads, or after a resync):
+    // prepend the partial sample left over from the previous transfer
+    if (carryBytes > 0)
+    {
+        memcpy (frameCarry + carryBytes, bufferPtr, return_code);
+        bufferPtr = frameCarry;
+        return_code += carryBytes;
+    }
+
     int index = 0;
-    int auxIndex, chanIndex;
-    int numStreams = enabledStreams.size();
-    int nSamps = Rhd2000DataBlockUsb3::getSamplesPerDataBlock();
+    int numSamples = 0;
+    int numAuxSamples = 0;
+    const DecodePlan& plan = frameDecoder->getPlan();
+    const int numAuxChannels = plan.numAuxChannels;
 
     //evalBoard->printFIFOmetrics();
-    for (int samp = 0; samp < nSamps; samp++)
+    while (index + (int) frameBytes <= return_code) // one transfer can hold several data blocks, or a few samples
     {
-        int channel = -1;
-
         if (! Rhd2000DataBlockUsb3::checkUsbHeader (bufferPtr, index))
         {
-            LOGE ("Error in Rhd2000EvalBoard::readDataBlock: Incorrect header.");
-            break;
-        }
-
-        index += 8; // magic number header width (bytes)
-        int64 timestamp = Rhd2000DataBlockUsb3::convertUsbTimeStamp (bufferPtr, index);
-        index += 4; // timestamp width
-        auxIndex = index; // aux chans start at this offset
-        index += 6 * numStreams; // width of the 3 aux chans
+            int headerIndex = findFrameHeader (bufferPtr, index, return_code);
 
-        for (int dataStream = 0; dataStream < numStreams; dataStream++)
-        {
-            int nChans = numChannelsPerDataStream[dataStream];
+            // without a header, keep the tail in case it holds the start of one
+            int resumeIndex = headerIndex >= 0 ? headerIndex : jmax (index, (int) return_code - 7);
 
-            chanIndex = index + 2 * dataStream;
+            ++numResyncs;
+            bytesSkipped += resumeIndex - index;
+            LOGE ("Incorrect Rhythm frame header, skipped ", resumeIndex - index, " bytes to resynchronise");
 
-            if ((chipId[dataStream] == CHIP_ID_RHD2132) && (nChans == 16)) //RHD2132 16ch. headstage
-            {
-                chanIndex += 2 * RHD2132_16CH_OFFSET * numStreams;
-            }
+            index = resumeIndex;
 
-            for (int chan = 0; chan < nChans; chan++)
-            {
-                channel++;
-                thisSample[channel] = float (*(uint16*) (bufferPtr + chanIndex) - 32768) * 0.195f;
-                chanIndex += 2 * numStreams; // single chan width (2 bytes)
-            }
+            if (headerIndex < 0 || index + (int) frameBytes > return_code)
+                break;
         }
-        index += 64 * numStreams; // neural data width
-        auxIndex += 2 * numStreams; // skip AuxCmd1 slots (see updateRegisters())
-        // copy the 3 aux channels
-        if (settings.acquireAux)
+
+        // collect the run of consecutive frames with valid headers, then decode it in one call
+        const uint16* frames = (const uint16*) (bufferPtr + index);
+        int runStart = numSamples;
+
+        do
         {
-            for (int dataStream = 0; dataStream < numStreams; dataStream++)
+            int64 timestamp = DecodePlan::getTimestamp ((const uint16*) (bufferPtr + index));
+
+            // flag lost samples instead of hiding them: sample numbers follow the frame timestamps
+            if (timestamp != nextTimestamp && nextTimestamp >= 0)
             {
-                if (chipId[dataStream] != CHIP_ID_RHD2164_B)
+                if (timestamp > nextTimestamp)
                 {
-                    int auxNum = (samp + 3) % 4;
-                    if (auxNum < 3)
-                    {
-                        auxSamples[dataStream][auxNum] = float (*(uint16*) (bufferPtr + auxIndex) - 32768) * 0.0000374;
-                    }
-                    for (int chan = 0; chan < 3; chan++)
-                    {
-                        channel++;
-                        if (auxNum == 3)
-                        {
-                            auxBuffer[channel] = auxSamples[dataStream][chan];
-                        }
-                        thisSample[channel] = auxBuffer[channel];
-                    }
+                    samplesLost += timestamp - nextTimestamp;
+                    LOGE ("Gap in Rhythm data: ", timestamp - nextTimestamp, " samples lost before sample ", timestamp);
+                }
+                else
+                {
+                    LOGE ("Rhythm timestamp went backwards from ", nextTimestamp - 1, " to ", timestamp);
                 }
-                auxIndex += 2; // single chan width (2 bytes)
             }
-        }
+            nextTimestamp = timestamp + 1;
 
-        //skip filler words
-        index += 2 * (numStreams % 4);
+            blockSampleNumbers[numSamples++] = timestamp;
+            index += frameBytes;
 
-        if (settings.acquireAdc)
-        {
-            for (int adcChan = 0; adcChan < 8; ++adcChan)
-            {
-                channel++;
-                // ADC waveform units = volts
-                thisSample[channel] =
-                    0.0003125 * float (*(uint16*) (bufferPtr + index)) - 10.24; // account for +/-10.24V input range and DC offset
-                index += 2;
-            }
-        }
+        } while (index + (int) frameBytes <= return_code && Rhd2000DataBlockUsb3::checkUsbHeader (bufferPtr, index));
+
+        for (size_t g = 0; g < runOutputs.size(); g++)
+            runOutputs[g] = groupSamples[g] + (size_t) runStart * plan.groups[g].numChannels;
+
+        if (decodePool != nullptr)
+            numAuxSamples += decodePool->decodeFrames (frames,
+                                                       numSamples - runStart,
+                                                       blockSampleNumbers + runStart,
+                                                       runOutputs.data(),
+                                                       blockEventCodes + runStart,
+                                                       auxSamples + (size_t) numAuxSamples * numAuxChannels,
+                                                       auxSampleNumbers + numAuxSamples);
         else
+            numAuxSamples += frameDecoder->decodeFrames (frames,
+                                                         numSamples - runStart,
+                                                         blockSampleNumbers + runStart,
+                                                         runOutputs.data(),
+                                                         blockEventCodes + runStart,
+                                                         auxSamples + (size_t) numAuxSamples * numAuxChannels,
+                                                         auxSampleNumbers + numAuxSamples);
+    }
+
+    // hand the whole transfer to the DataBuffer at once; samples stay interleaved
+    // (chunkSize 1) so the copy is correct wherever the buffer wraps
+    if (numSamples > 0)
+    {
+        // the TTL inputs belong to the first stream
+        for (size_t g = 0; g < groupSamples.size(); g++)
         {
-            index += 16;
+            sourceBuffers[(int) g]->addToBuffer (groupSamples[g],
+                                                 blockSampleNumbers,
+                                                 blockTimestamps,
+                                                 g == 0 ? blockEventCodes : blockNoEventCodes,
+                                                 numSamples);
         }
+    }
 
-        uint64 ttlEventWord = *(uint64*) (bufferPtr + index) & 65535;
-
-        index += 4;
+    if (numAuxSamples > 0)
+    {
+        sourceBuffers[auxBufferIndex]->addToBuffer (auxSamples,
+                                                    auxSampleNumbers,
+                                                    auxTimestamps,
+                                                    auxEventCodes,
+                                                    numAuxSamples);
+    }
 
-        sourceBuffers[0]->addToBuffer (thisSample,
-                                       &timestamp,
-                                       &ts,
-                                       &ttlEventWord,
-                                       1);
+    if (numSamples > 0)
+    {
+        decodeLatency.addSampleSince (decodeStartTicks);
+        usbToBufferLatency.addSampleSince (arrivalTicks);
     }
 
+    carryBytes = return_code - index;
+    if (carryBytes > 0)
+        memmove (frameCarry, bufferPtr + index, carryBytes);
+
     if (updateSettingsDuringAcquisition)
     {
         LOGD ("DAC");
@@ -1709,14 +2269,24 @@ bool DeviceThread::updateBuffer()
 
     if (! digitalOutputCommands.empty())
     {
+        // request times of the triggers applied by this write (one per TTL line is enough)
+        int64 triggerTicks[8];
+        int numTriggers = 0;
+
         while (! digitalOutputCommands.empty())
         {
             DigitalOutputCommand command = digitalOutputCommands.front();
             TTL_OUTPUT_STATE[command.ttlLine] = command.state;
             digitalOutputCommands.pop();
+
+            if (command.requestTicks != 0 && numTriggers < numElementsInArray (triggerTicks))
+                triggerTicks[numTriggers++] = command.requestTicks;
         }
 
         evalBoard->setTtlOut (TTL_OUTPUT_STATE);
+
+        for (int i = 0; i < numTriggers; i++)
+            triggerLatency.addSampleSince (triggerTicks[i]);
     }
 
     return true;
@@ -1724,50 +2294,57 @@ bool DeviceThread::updateBuffer()
 
 int DeviceThread::getChannelFromHeadstage (int hs, int ch)
 {
-    int channelCount = 0;
-    int hsCount = 0;
-    if (hs < 0 || hs >= headstages.size() + 1)
+    if (hs < 0 || hs >= headstages.size() + 1 || ch < 0)
         return -1;
     if (hs == headstages.size()) //let's consider this the ADC channels
     {
-        int adcOutputs = getNumDataOutputs (ContinuousChannel::ADC);
-
-        if (adcOutputs > 0)
-        {
-            return getNumDataOutputs (ContinuousChannel::ELECTRODE) + getNumDataOutputs (ContinuousChannel::AUX) + ch;
-        }
+        if (ch < getNumDataOutputs (ContinuousChannel::ADC))
+            return getNumDataOutputs (ContinuousChannel::ELECTRODE) + ch;
         else
             return -1;
     }
-    if (headstages[hs]->isConnected())
+
+    const Headstage* headstage = headstages[hs];
+
+    if (! headstage->isConnected())
+        return -1;
+
+    const int numActive = headstage->getNumActiveChannels();
+
+    if (ch < numActive)
     {
-        if (ch < 0)
+        // disabled channels are not published
+        if (! headstage->isChannelEnabled (ch))
             return -1;
-        if (ch < headstages[hs]->getNumActiveChannels())
+
+        int channelCount = 0;
+
+        for (int i = 0; i < hs; i++)
         {
-            for (int i = 0; i < hs; i++)
-            {
-                channelCount += headstages[i]->getNumActiveChannels();
-            }
-            return channelCount + ch;
+            if (headstages[i]->isConnected())
+                channelCount += headstages[i]->getNumEnabledChannels();
         }
-        else if (ch < headstages[hs]->getNumActiveChannels() + 3)
+
+        for (int c = 0; c < ch; c++)
         {
-            for (int i = 0; i < headstages.size(); i++)
-            {
-                if (headstages[i]->isConnected())
-                {
-                    channelCount += headstages[i]->getNumActiveChannels();
-                    if (i < hs)
-                        hsCount++;
-                }
-            }
-            return channelCount + hsCount * 3 + ch - headstages[hs]->getNumActiveChannels();
+            if (headstage->isChannelEnabled (c))
+                channelCount++;
         }
-        else
+
+        return channelCount;
+    }
+    else if (ch < numActive + 3 && settings.acquireAux)
+    {
+        // aux channels follow the ADC channels, three per connected headstage
+        int hsCount = 0;
+
+        for (int i = 0; i < hs; i++)
         {
-            return -1;
+            if (headstages[i]->isConnected())
+                hsCount++;
         }
+
+        return getNumDataOutputs (ContinuousChannel::ELECTRODE) + getNumDataOutputs (ContinuousChannel::ADC) + hsCount * 3 + ch - numActive;
     }
     else
     {
@@ -1791,7 +2368,6 @@ Array<const Headstage*> DeviceThread::getConnectedHeadstages()
 int DeviceThread::getHeadstageChannel (int& hs, int ch) const
 {
     int channelCount = 0;
-    int hsCount = 0;
 
     if (ch < 0)
         return -1;
@@ -1800,32 +2376,40 @@ int DeviceThread::getHeadstageChannel (int& hs, int ch) const
     {
         if (headstages[i]->isConnected())
         {
-            int chans = headstages[i]->getNumActiveChannels();
+            int chans = headstages[i]->getNumEnabledChannels();
 
             if (ch >= channelCount && ch < channelCount + chans)
             {
                 hs = i;
-                return ch - channelCount;
+
+                // the n-th enabled channel, counting past the disabled ones
+                int n = ch - channelCount;
+
+                for (int c = 0; c < headstages[i]->getNumActiveChannels(); c++)
+                {
+                    if (headstages[i]->isChannelEnabled (c) && n-- == 0)
+                        return c;
+                }
             }
             channelCount += chans;
-            hsCount++;
         }
     }
-    if (ch < (channelCount + hsCount * 3)) //AUX
-    {
-        hsCount = (ch - channelCount) / 3;
+    // aux channels follow the ADC channels (in their own quarter-rate stream)
+    if (settings.acquireAdc)
+        channelCount += 8;
 
+    if (settings.acquireAux)
+    {
         for (int i = 0; i < headstages.size(); i++)
         {
             if (headstages[i]->isConnected())
             {
-                if (hsCount == 0)
+                if (ch >= channelCount && ch < channelCount + 3) //AUX
                 {
                     hs = i;
-                    return ch - channelCount;
+                    return headstages[i]->getNumActiveChannels() + ch - channelCount;
                 }
-                hsCount--;
-                channelCount++;
+                channelCount += 3;
             }
         }
     }
@@ -1879,6 +2463,266 @@ short DeviceThread::getAdcRange (int channel) const
     return adcRangeSettings[channel];
 }
 
+void DeviceThread::setUsbBlocksPerRead (int numBlocks)
+{
+    settings.usbBlocksOverride = jmax (0, numBlocks);
+}
+
+int DeviceThread::getUsbBlocksPerRead() const
+{
+    return settings.usbBlocksOverride;
+}
+
+int DeviceThread::getEffectiveUsbBlocksPerRead() const
+{
+    if (settings.usbBlocksOverride > 0)
+        return settings.usbBlocksOverride;
+
+    return settings.numUsbBlocksToRead;
+}
+
+void DeviceThread::setUsbBufferCount (int numBuffers)
+{
+    settings.usbBufferCount = jlimit (2, 256, numBuffers);
+}
+
+int DeviceThread::getUsbBufferCount() const
+{
+    return settings.usbBufferCount;
+}
+
+void DeviceThread::setUsbTransferMode (UsbTransferMode mode)
+{
+    settings.usbTransferMode = mode;
+}
+
+UsbTransferMode DeviceThread::getUsbTransferMode() const
+{
+    return settings.usbTransferMode;
+}
+
+void DeviceThread::setUsbTargetLatency (float latencyMs)
+{
+    settings.usbTargetLatencyMs = jlimit (0.0f, 1000.0f, latencyMs);
+}
+
+float DeviceThread::getUsbTargetLatency() const
+{
+    return settings.usbTargetLatencyMs;
+}
+
+void DeviceThread::setLowLatencyChunkSize (int numSamples)
+{
+    settings.lowLatencyChunkSamples = jlimit (8, 32, numSamples);
+}
+
+int DeviceThread::getLowLatencyChunkSize() const
+{
+    return settings.lowLatencyChunkSamples;
+}
+
+void DeviceThread::setDecodeThreads (int numThreads)
+{
+    settings.decodeThreads = jlimit (0, jmax (0, SystemStats::getNumCpus() - 1), numThreads);
+}
+
+int DeviceThread::getDecodeThreads() const
+{
+    return settings.decodeThreads;
+}
+
+void DeviceThread::setDecodeFirstCore (int firstCore)
+{
+    settings.decodeFirstCore = jmax (-1, firstCore);
+}
+
+int DeviceThread::getDecodeFirstCore() const
+{
+    return settings.decodeFirstCore;
+}
+
+void DeviceThread::selectRegisterConfigBanks()
+{
+    const Rhd2000EvalBoardUsb3::BoardPort ports[] = { Rhd2000EvalBoardUsb3::PortA,
+                                                      Rhd2000EvalBoardUsb3::PortB,
+                                                      Rhd2000EvalBoardUsb3::PortC,
+                                                      Rhd2000EvalBoardUsb3::PortD,
+                                                      Rhd2000EvalBoardUsb3::PortE,
+                                                      Rhd2000EvalBoardUsb3::PortF,
+                                                      Rhd2000EvalBoardUsb3::PortG,
+                                                      Rhd2000EvalBoardUsb3::PortH };
+
+    for (int port = 0; port < 8; port++)
+        evalBoard->selectAuxCommandBank (ports[port], Rhd2000EvalBoardUsb3::AuxCmd3, portConfigBanks[port]);
+}
+
+int DeviceThread::getActiveChannelIndex (int channel) const
+{
+    if (channel < 0)
+        return channel;
+
+    int enabledCount = 0;
+    int activeCount = 0;
+
+    for (auto headstage : headstages)
+    {
+        if (! headstage->isConnected())
+            continue;
+
+        for (int ch = 0; ch < headstage->getNumActiveChannels(); ch++)
+        {
+            if (headstage->isChannelEnabled (ch) && enabledCount++ == channel)
+                return activeCount + ch;
+        }
+
+        activeCount += headstage->getNumActiveChannels();
+    }
+
+    return -1;
+}
+
+void DeviceThread::setChannelEnabled (int hsNum, int ch, bool enabled)
+{
+    if (hsNum < 0 || hsNum >= headstages.size() || isChannelEnabled (hsNum, ch) == enabled)
+        return;
+
+    headstages[hsNum]->setChannelEnabled (ch, enabled);
+
+    resizeSourceBuffers();
+
+    if (settings.powerDownDisabledAmps)
+        updateRegisters();
+}
+
+bool DeviceThread::isChannelEnabled (int hsNum, int ch) const
+{
+    if (hsNum < 0 || hsNum >= headstages.size())
+        return true;
+
+    return headstages[hsNum]->isChannelEnabled (ch);
+}
+
+void DeviceThread::enableAllChannels()
+{
+    for (auto hs : headstages)
+        hs->enableAllChannels();
+
+    resizeSourceBuffers();
+
+    if (settings.powerDownDisabledAmps)
+        updateRegisters();
+}
+
+void DeviceThread::setPowerDownDisabledAmps (bool enabled)
+{
+    if (settings.powerDownDisabledAmps != enabled)
+    {
+        settings.powerDownDisabledAmps = enabled;
+        updateRegisters();
+    }
+}
+
+bool DeviceThread::getPowerDownDisabledAmps() const
+{
+    return settings.powerDownDisabledAmps;
+}
+
+void DeviceThread::setAdaptiveImpedanceRanges (bool enabled)
+{
+    settings.adaptiveImpedanceRanges = enabled;
+}
+
+bool DeviceThread::getAdaptiveImpedanceRanges() const
+{
+    return settings.adaptiveImpedanceRanges;
+}
+
+void DeviceThread::setImpedanceFrequencies (const Array<float>& frequencies)
+{
+    settings.impedanceFrequencies = frequencies;
+}
+
+Array<float> DeviceThread::getImpedanceFrequencies() const
+{
+    return settings.impedanceFrequencies;
+}
+
+void DeviceThread::setRawFrameDirectory (const String& directory)
+{
+    settings.rawFrameDirectory = directory;
+}
+
+String DeviceThread::getRawFrameDirectory() const
+{
+    return settings.rawFrameDirectory;
+}
+
+String DeviceThread::getLatencyReport() const
+{
+    return "Rhythm host latency"
+           "\n  USB transfer read -> decode start: " + usbQueueLatency.getSummary()
+           + "\n  decode start -> DataBuffer: " + decodeLatency.getSummary()
+           + "\n  USB transfer read -> DataBuffer: " + usbToBufferLatency.getSummary()
+           + "\n  TRIGGER received -> TTL output written: " + triggerLatency.getSummary();
+}
+
+void DeviceThread::writeRawFrameHeader (const File& headerFile, const std::vector<DecodePlan::StreamLayout>& streamLayouts)
+{
+    XmlElement xml ("RHYTHM_RAW_FRAMES");
+
+    xml.setAttribute ("version", 1);
+    xml.setAttribute ("data_file", rawFrameRecorder->getFile().getFileName());
+    xml.setAttribute ("start_time", Time::getCurrentTime().toISO8601 (true));
+    xml.setAttribute ("sample_rate", settings.boardSampleRate);
+    xml.setAttribute ("num_streams", enabledStreams.size());
+    xml.setAttribute ("frame_bytes", (int) frameBytes);
+    xml.setAttribute ("header_magic", "0xd7a22aaa38132a53");
+    xml.setAttribute ("aux_enabled", settings.acquireAux);
+    xml.setAttribute ("adc_enabled", settings.acquireAdc);
+    xml.setAttribute ("amplifier_bit_volts", 0.195);
+    xml.setAttribute ("aux_bit_volts", 0.0000374);
+    xml.setAttribute ("lower_bandwidth", settings.dsp.lowerBandwidth);
+    xml.setAttribute ("upper_bandwidth", settings.dsp.upperBandwidth);
+    xml.setAttribute ("dsp_cutoff", settings.dsp.enabled ? settings.dsp.cutoffFreq : 0.0);
+
+    // one entry per data stream, in the order the streams appear in each frame
+    for (int i = 0; i < enabledStreams.size(); i++)
+    {
+        const DecodePlan::StreamLayout& layout = streamLayouts[i];
+
+        XmlElement* streamXml = xml.createNewChildElement ("STREAM");
+        streamXml->setAttribute ("index", i);
+        streamXml->setAttribute ("board_stream", enabledStreams[i]);
+        streamXml->setAttribute ("headstage", headstages[enabledStreams[i] / 2]->getStreamPrefix());
+        streamXml->setAttribute ("chip_id", chipId[i]);
+        streamXml->setAttribute ("channels", layout.numChannels);
+        streamXml->setAttribute ("first_chip_channel", layout.firstChipChannel);
+        streamXml->setAttribute ("has_aux", layout.hasAux);
+        streamXml->setAttribute ("channel_mask", "0x" + String::toHexString ((int) layout.channelMask));
+    }
+
+    for (int ch = 0; ch < 8; ch++)
+    {
+        XmlElement* adcXml = xml.createNewChildElement ("ADC");
+        adcXml->setAttribute ("channel", ch);
+        adcXml->setAttribute ("bit_volts", getAdcBitVolts (ch));
+    }
+
+    if (! xml.writeTo (headerFile))
+        LOGE ("Could not write raw frame header ", headerFile.getFullPathName());
+}
+
+void DeviceThread::setStreamPerHeadstage (bool enabled)
+{
+    settings.streamPerHeadstage = enabled;
+    resizeSourceBuffers();
+}
+
+bool DeviceThread::getStreamPerHeadstage() const
+{
+    return settings.streamPerHeadstage;
+}
+
 void DeviceThread::runImpedanceTest()
 {
     impedanceThread->stopThreadSafely();
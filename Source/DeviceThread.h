@@ -35,6 +35,9 @@
 #include "rhythm-api/rhd2000evalboardusb3.h"
 #include "rhythm-api/rhd2000registersusb3.h"
 
+#include "FrameDecoder.h"
+#include "LatencyHistogram.h"
+
 #define CHIP_ID_RHD2132 1
 #define CHIP_ID_RHD2216 2
 #define CHIP_ID_RHD2164 4
@@ -49,6 +52,8 @@ namespace RhythmNode
 class Headstage;
 class ImpedanceMeter;
 class USBThread;
+class DecodeThreadPool;
+class RawFrameRecorder;
 
 enum ChannelNamingScheme
 {
@@ -56,12 +61,33 @@ enum ChannelNamingScheme
     STREAM_INDEX = 2
 };
 
+enum UsbTransferMode
+{
+    FIXED_TRANSFERS = 1,
+    ADAPTIVE_TRANSFERS = 2,
+    LOW_LATENCY_TRANSFERS = 3
+};
+
 struct Impedances
 {
     Array<int> streams;
     Array<int> channels;
     Array<float> magnitudes;
     Array<float> phases;
+
+    /** Test frequencies of a sweep */
+    Array<float> frequencies;
+
+    /** The test frequency of magnitudes and phases: the one nearest 1 kHz */
+    float primaryFrequency = 0.0f;
+
+    /** Values at every test frequency, frequency-major: index f * streams.size() + i */
+    Array<float> sweepMagnitudes;
+    Array<float> sweepPhases;
+
+    /** The board's data streams when these were measured; see DeviceThread::getStreamLayout() */
+    Array<int> streamLayout;
+
     bool valid = false;
 };
 
@@ -129,10 +155,10 @@ public:
 
     int getChannelsInHeadstage (int hsNum) const;
 
-    /* Gets the absolute channel index from the headstage channel index*/
+    /* Gets the absolute channel index from the headstage channel index, or -1 for a disabled channel*/
     int getChannelFromHeadstage (int hs, int ch);
 
-    /*Gets the headstage relative channel index from the absolute channel index*/
+    /*Gets the headstage relative channel index from the absolute channel index; only enabled channels are counted*/
     int getHeadstageChannel (int& hs, int ch) const;
 
     // for communication with SourceNode processors:
@@ -202,6 +228,106 @@ public:
 
     short getAdcRange (int adcChannel) const;
 
+    /** Overrides the number of data blocks requested per USB transfer (0 = choose from sample rate) */
+    void setUsbBlocksPerRead (int numBlocks);
+
+    /** Returns the USB blocks-per-transfer override (0 = automatic) */
+    int getUsbBlocksPerRead() const;
+
+    /** Returns the number of data blocks that will be requested per USB transfer */
+    int getEffectiveUsbBlocksPerRead() const;
+
+    /** Sets the number of USB transfer buffers queued between the USB reader and the decoder */
+    void setUsbBufferCount (int numBuffers);
+
+    /** Returns the number of USB transfer buffers */
+    int getUsbBufferCount() const;
+
+    /** Selects fixed-size USB transfers or transfers sized from the FIFO backlog */
+    void setUsbTransferMode (UsbTransferMode mode);
+
+    /** Returns the USB transfer mode */
+    UsbTransferMode getUsbTransferMode() const;
+
+    /** Sets the FIFO backlog (in ms) above which adaptive transfers grow to drain it */
+    void setUsbTargetLatency (float latencyMs);
+
+    /** Returns the adaptive transfer target latency (in ms) */
+    float getUsbTargetLatency() const;
+
+    /** Sets the number of samples read and processed at once in low latency mode (8-32) */
+    void setLowLatencyChunkSize (int numSamples);
+
+    /** Returns the low latency chunk size (in samples) */
+    int getLowLatencyChunkSize() const;
+
+    /** Sets the number of extra threads that share the decoding of each transfer
+        (0 decodes everything on the acquisition thread); applied on the next start */
+    void setDecodeThreads (int numThreads);
+
+    /** Returns the number of extra decode threads */
+    int getDecodeThreads() const;
+
+    /** Pins decode thread i to core firstCore + i (-1 leaves them unpinned) */
+    void setDecodeFirstCore (int firstCore);
+
+    /** Returns the first core decode threads are pinned to, or -1 */
+    int getDecodeFirstCore() const;
+
+    /** Publishes one DataStream per connected headstage plus one for the ADCs, instead of
+        a single stream for all channels, so downstream processors can work on them in parallel */
+    void setStreamPerHeadstage (bool enabled);
+
+    /** Returns true if each headstage gets its own DataStream */
+    bool getStreamPerHeadstage() const;
+
+    /** Enables or disables a headstage channel (index among its active channels); disabled
+        channels are dropped from the channel list and not decoded, from the next start */
+    void setChannelEnabled (int hsNum, int ch, bool enabled);
+
+    /** Returns true if a headstage channel is enabled */
+    bool isChannelEnabled (int hsNum, int ch) const;
+
+    /** Enables every channel of every headstage */
+    void enableAllChannels();
+
+    /** Switches off the amplifiers of disabled channels on the chips (a channel stays powered
+        if the other headstage on the same port still uses it) */
+    void setPowerDownDisabledAmps (bool enabled);
+
+    /** Returns true if disabled channels' amplifiers are powered down */
+    bool getPowerDownDisabledAmps() const;
+
+    /** Measures impedances starting from the Cseries range that suits each site's last
+        impedance, re-measuring only sites whose amplitude calls for another range,
+        instead of always measuring all three ranges */
+    void setAdaptiveImpedanceRanges (bool enabled);
+
+    /** Returns true if impedance measurements use the adaptive range sweep */
+    bool getAdaptiveImpedanceRanges() const;
+
+    /** Sets the test frequencies (Hz) of impedance measurements; each is measured
+        in turn and saved with the impedances. The channel impedances shown and
+        published are those at the frequency nearest 1 kHz. An empty list
+        measures at 1 kHz only */
+    void setImpedanceFrequencies (const Array<float>& frequencies);
+
+    /** Returns the impedance test frequencies */
+    Array<float> getImpedanceFrequencies() const;
+
+    /** Records every USB transfer, undecoded, to a new file in this directory on each start
+        (an empty path turns recording off). A sidecar .xml file holds the stream layout. */
+    void setRawFrameDirectory (const String& directory);
+
+    /** Returns the raw frame recording directory, or an empty string */
+    String getRawFrameDirectory() const;
+
+    /** Returns the p50/p99/max latency of each stage of the host loop since acquisition
+        started: USB transfer read -> decode start -> DataBuffer hand-off, and
+        RHDCONTROL TRIGGER received -> TTL output written. Time spent in the board's
+        FIFO and on the wire before a transfer completes is not included. */
+    String getLatencyReport() const;
+
     static DataThread* createDataThread (SourceNode* sn);
 
     class DigitalOutputTimer : public Timer
@@ -226,6 +352,9 @@ public:
     {
         int ttlLine;
         bool state;
+
+        /** When the TRIGGER message arrived (high resolution ticks), or 0 for commands that end a pulse */
+        int64 requestTicks = 0;
     };
 
     void addDigitalOutputCommand (DigitalOutputTimer* timerToDelete,
@@ -241,6 +370,33 @@ private:
 
     bool enableHeadstage (int hsNum, bool enabled, int nStr = 1, int strChans = 32);
     void updateBoardStreams();
+
+    /** Sizes the DataBuffers (one per DataStream) for the current channel settings */
+    void resizeSourceBuffers();
+
+    /** True if the stream-per-headstage option is on and there are headstage channels to split */
+    bool usesStreamPerHeadstage();
+
+    /** True if a headstage gets its own DataStream in stream-per-headstage mode: it is
+        connected and has enabled channels */
+    static bool hasHeadstageStream (const Headstage* headstage);
+
+    /** Returns the number of channels in each full-rate DataStream, in stream order */
+    Array<int> getStreamChannelCounts();
+
+    /** Converts an index among the published amplifier channels to an index among the
+        active channels (which also count disabled ones); negative indices are unchanged */
+    int getActiveChannelIndex (int channel) const;
+
+    /** Selects each port's AuxCmd3 register config (the shared one, or the port's own
+        if some of its amplifiers are powered down) */
+    void selectRegisterConfigBanks();
+
+    /** AuxCmd3 RAM bank holding each port's register config */
+    std::array<int, 8> portConfigBanks { { 1, 1, 1, 1, 1, 1, 1, 1 } };
+
+    /** Index of the aux stream's DataBuffer (after the full-rate streams) */
+    int auxBufferIndex = 1;
     void setCableLength (int hsNum, float length);
 
     /** Rhythm API classes*/
@@ -262,18 +418,77 @@ private:
     /** True if change in settings is needed during acquisition*/
     bool updateSettingsDuringAcquisition;
 
-    /** Data buffers*/
-    float thisSample[MAX_NUM_CHANNELS];
+    /** Data buffers: one transfer's worth of decoded samples (sample-major) with their
+        sample numbers, timestamps and TTL words, handed to the DataBuffer in one call */
+    HeapBlock<float> blockSamples;
+    HeapBlock<int64> blockSampleNumbers;
+    HeapBlock<double> blockTimestamps;
+    HeapBlock<uint64> blockEventCodes;
+    HeapBlock<uint64> blockNoEventCodes;
+
+    /** Start of each DataStream's samples within blockSamples, and of the current run */
+    std::vector<float*> groupSamples;
+    std::vector<float*> runOutputs;
 
-    float auxBuffer[MAX_NUM_CHANNELS]; // aux inputs are only sampled every 4th sample, so use this to buffer the
-    // samples so they can be handles just like the regular neural channels later
+    /** Quarter-rate aux samples decoded from the same transfer, for the aux stream's buffer */
+    HeapBlock<float> auxSamples;
+    HeapBlock<int64> auxSampleNumbers;
+    HeapBlock<double> auxTimestamps;
+    HeapBlock<uint64> auxEventCodes;
 
-    float auxSamples[MAX_NUM_DATA_STREAMS][3];
+    /** Turns USB frames into samples, rebuilt for each acquisition */
+    std::unique_ptr<FrameDecoder> frameDecoder;
+
+    /** Shares the decoding across threads when decode threads are enabled */
+    std::unique_ptr<DecodeThreadPool> decodePool;
+
+    /** Copies the raw USB transfers to disk when a raw frame directory is set */
+    std::unique_ptr<RawFrameRecorder> rawFrameRecorder;
+
+    /** Writes the layout needed to decode the raw frame file */
+    void writeRawFrameHeader (const File& headerFile, const std::vector<DecodePlan::StreamLayout>& streamLayouts);
+
+    /** Returns the acquisition board, or a ReplayBoard playing back the raw frame
+        recording named by the RHYTHM_REPLAY_FILE environment variable
+        (RHYTHM_REPLAY_SPEED=max drops the real-time pacing, RHYTHM_REPLAY_LOOP=1 loops),
+        or an EmulatorBoard with the headstages listed in RHYTHM_EMULATE, e.g.
+        "A1:RHD2164,B1:RHD2132" (RHYTHM_EMULATE_SPEED=max drops the pacing) */
+    std::unique_ptr<Rhd2000EvalBoardUsb3> createBoard();
+
+    /** Enables the headstages and channels of the replayed recording instead of probing the ports */
+    void scanReplayStreams();
+
+    /** Header of the raw frame recording being replayed, or nullptr for a real board */
+    std::unique_ptr<XmlElement> replayLayout;
 
     std::unique_ptr<USBThread> usbThread;
 
     unsigned int blockSize;
 
+    /** Size of one frame (one sample from every stream) in the USB buffer */
+    unsigned int frameBytes;
+
+    /** Holds a partial sample left over from the previous transfer, followed by the next transfer */
+    HeapBlock<unsigned char> frameCarry;
+    int carryBytes;
+
+    /** Returns the offset of the next frame header at or after start + 1, or -1 if there is none */
+    int findFrameHeader (unsigned char* buffer, int start, int numBytes) const;
+
+    /** Timestamp expected in the next frame (-1 before the first frame), used to detect gaps */
+    int64 nextTimestamp;
+
+    /** Frame synchronisation statistics since acquisition start */
+    int64 numResyncs;
+    int64 bytesSkipped;
+    int64 samplesLost;
+
+    /** Host latency statistics since acquisition start (see getLatencyReport()) */
+    LatencyHistogram usbQueueLatency;
+    LatencyHistogram decodeLatency;
+    LatencyHistogram usbToBufferLatency;
+    LatencyHistogram triggerLatency;
+
     /** Cable length settings */
     struct CableLength
     {
@@ -325,6 +540,20 @@ private:
         int numberingScheme = 1;
         uint16 clockDivideFactor;
 
+        int usbBufferCount = 8;
+        int numUsbBlocksToRead = 16;
+        int usbBlocksOverride = 0;
+        UsbTransferMode usbTransferMode = FIXED_TRANSFERS;
+        float usbTargetLatencyMs = 10.0f;
+        int lowLatencyChunkSamples = 16;
+        int decodeThreads = 0;
+        int decodeFirstCore = -1;
+        bool streamPerHeadstage = false;
+        bool powerDownDisabledAmps = false;
+        bool adaptiveImpedanceRanges = false;
+        Array<float> impedanceFrequencies;
+        String rawFrameDirectory;
+
     } settings;
 
     /** Path to Opal Kelly library file*/
@@ -348,6 +577,10 @@ private:
     /** Returns the device ID for an Intan chip*/
     int getDeviceId (Rhd2000DataBlockUsb3* dataBlock, int stream, int& register59Value);
 
+    /** Identifies the source and chip of every enabled data stream; impedances are
+        indexed by stream, so they only carry over while this is unchanged */
+    Array<int> getStreamLayout() const;
+
     int *dacChannels, *dacStream;
     float* dacThresholds;
     bool* dacChannelsToUpdate;
@@ -368,8 +601,6 @@ private:
 
     StringArray channelNames;
 
-    double ts = 0; // placeholder double timestamp value
-
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DeviceThread);
 };
 
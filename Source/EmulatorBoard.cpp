@@ -0,0 +1,461 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "EmulatorBoard.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+using namespace RhythmNode;
+
+// Intan chip IDs (ROM register 63) and the register 59 values of the two RHD2164 MISO lines
+static const int chipIdRhd2132 = 1;
+static const int chipIdRhd2216 = 2;
+static const int chipIdRhd2164 = 4;
+static const int register59MisoA = 53;
+static const int register59MisoB = 58;
+
+/** Distinct amplifier signals; channels share them at different phases */
+static const int numSignals = 8;
+
+static const double pi = 3.14159265358979323846;
+
+EmulatorBoard::EmulatorBoard (bool realTime)
+    : VirtualBoard (realTime)
+{
+    headstageChips.fill (0);
+    nominalDelays.fill (2);
+
+    for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; stream++)
+        resetRegisters (stream);
+
+    for (int slot = 0; slot < 3; slot++)
+    {
+        commandLoopIndex[slot] = 0;
+        commandEndIndex[slot] = 0;
+
+        for (int port = 0; port < MAX_NUM_SPI_PORTS; port++)
+            commandBanks[port][slot] = 0;
+    }
+
+    createSignals();
+}
+
+EmulatorBoard::~EmulatorBoard()
+{
+}
+
+void EmulatorBoard::setHeadstage (int headstage, int chipId)
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    if (headstage < 0 || headstage >= numHeadstages)
+        return;
+
+    headstageChips[headstage] = chipId;
+
+    resetRegisters (2 * headstage);
+    resetRegisters (2 * headstage + 1);
+}
+
+bool EmulatorBoard::setHeadstages (const std::string& spec)
+{
+    std::vector<std::pair<int, int>> entries;
+
+    std::stringstream list (spec);
+    std::string entry;
+
+    while (std::getline (list, entry, ','))
+    {
+        entry.erase (std::remove (entry.begin(), entry.end(), ' '), entry.end());
+
+        if (entry.empty())
+            continue;
+
+        const size_t colon = entry.find (':');
+
+        if (colon == std::string::npos)
+            return false;
+
+        const std::string slot = entry.substr (0, colon);
+        std::string chip = entry.substr (colon + 1);
+
+        if (chip.compare (0, 3, "RHD") == 0)
+            chip = chip.substr (3);
+
+        int chipId;
+
+        if (chip == "2132")
+            chipId = chipIdRhd2132;
+        else if (chip == "2216")
+            chipId = chipIdRhd2216;
+        else if (chip == "2164")
+            chipId = chipIdRhd2164;
+        else
+            return false;
+
+        if (slot == "all")
+        {
+            for (int hs = 0; hs < numHeadstages; hs++)
+                entries.push_back ({ hs, chipId });
+        }
+        else if (slot.size() == 2 && slot[0] >= 'A' && slot[0] < 'A' + MAX_NUM_SPI_PORTS && (slot[1] == '1' || slot[1] == '2'))
+        {
+            entries.push_back ({ 2 * (slot[0] - 'A') + (slot[1] - '1'), chipId });
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if (entries.empty())
+        return false;
+
+    for (int hs = 0; hs < numHeadstages; hs++)
+        setHeadstage (hs, 0);
+
+    for (const auto& e : entries)
+        setHeadstage (e.first, e.second);
+
+    return true;
+}
+
+int EmulatorBoard::getNumChannels() const
+{
+    int numChannels = 0;
+
+    for (int chipId : headstageChips)
+    {
+        if (chipId == chipIdRhd2164)
+            numChannels += 64;
+        else if (chipId == chipIdRhd2132)
+            numChannels += 32;
+        else if (chipId == chipIdRhd2216)
+            numChannels += 16;
+    }
+
+    return numChannels;
+}
+
+void EmulatorBoard::setNominalCableDelay (BoardPort port, int delay)
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    if (port >= 0 && port < MAX_NUM_SPI_PORTS)
+        nominalDelays[port] = delay;
+}
+
+void EmulatorBoard::resetRegisters (int boardStream)
+{
+    std::array<uint8_t, 64>& regs = registers[boardStream];
+    regs.fill (0);
+
+    const int chipId = headstageChips[boardStream / 2];
+    const bool misoB = (boardStream & 1) != 0;
+
+    // only the RHD2164 drives the second MISO line
+    if (chipId == 0 || (misoB && chipId != chipIdRhd2164))
+        return;
+
+    const char* name = chipId == chipIdRhd2164 ? "RHD2164" : (chipId == chipIdRhd2216 ? "RHD2216" : "RHD2132");
+
+    memcpy (&regs[40], "INTAN", 5);
+    memcpy (&regs[48], name, 7);
+
+    regs[59] = chipId == chipIdRhd2164 ? (misoB ? register59MisoB : register59MisoA) : 0;
+    regs[60] = 1; // die revision
+    regs[61] = chipId == chipIdRhd2216 ? 1 : 0; // unipolar amplifiers
+    regs[62] = chipId == chipIdRhd2164 ? 64 : (chipId == chipIdRhd2216 ? 16 : 32);
+    regs[63] = (uint8_t) chipId;
+}
+
+void EmulatorBoard::createSignals()
+{
+    // one second at the highest sample rate; sines complete whole cycles, so the table loops cleanly
+    signalLength = 30000;
+    signals.resize ((size_t) numSignals * signalLength);
+
+    uint32_t random = 0x12345678;
+
+    auto nextRandom = [&random]() -> double
+    {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        return random / 4294967296.0 - 0.5;
+    };
+
+    std::vector<double> microvolts (signalLength);
+
+    for (int k = 0; k < numSignals; k++)
+    {
+        const int cycles = 3 + 5 * k;
+        const double sineAmplitude = 40.0 + 10.0 * k;
+        const double spikeAmplitude = 80.0 + 20.0 * k;
+
+        for (int n = 0; n < signalLength; n++)
+        {
+            // sum of four uniform values, scaled to about 8 uV rms
+            const double noise = (nextRandom() + nextRandom() + nextRandom() + nextRandom()) * 8.0 / 0.577;
+            microvolts[n] = sineAmplitude * std::sin (2.0 * pi * cycles * n / signalLength) + noise;
+        }
+
+        // biphasic spikes: a 0.5 ms trough and a 1 ms recovery (at 30 kS/s)
+        const int numSpikes = 3 * (k + 1);
+
+        for (int i = 0; i < numSpikes; i++)
+        {
+            const int start = (int) ((nextRandom() + 0.5) * (signalLength - 45));
+
+            for (int n = 0; n < 15; n++)
+                microvolts[start + n] -= spikeAmplitude * std::sin (pi * n / 15.0);
+
+            for (int n = 0; n < 30; n++)
+                microvolts[start + 15 + n] += spikeAmplitude / 3.0 * std::sin (pi * n / 30.0);
+        }
+
+        for (int n = 0; n < signalLength; n++)
+        {
+            const double word = 32768.0 + std::round (microvolts[n] / 0.195);
+            signals[(size_t) k * signalLength + n] = (uint16_t) std::max (0.0, std::min (65535.0, word));
+        }
+    }
+}
+
+void EmulatorBoard::uploadCommandList (const std::vector<int>& commandList, AuxCmdSlot auxCommandSlot, int bank)
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    if (bank >= 0 && bank < numBanks)
+        commandLists[auxCommandSlot][bank] = commandList;
+}
+
+void EmulatorBoard::selectAuxCommandBank (BoardPort port, AuxCmdSlot auxCommandSlot, int bank)
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    if (port >= 0 && port < MAX_NUM_SPI_PORTS && bank >= 0 && bank < numBanks)
+        commandBanks[port][auxCommandSlot] = bank;
+}
+
+void EmulatorBoard::selectAuxCommandLength (AuxCmdSlot auxCommandSlot, int loopIndex, int endIndex)
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    commandLoopIndex[auxCommandSlot] = loopIndex;
+    commandEndIndex[auxCommandSlot] = endIndex;
+}
+
+void EmulatorBoard::startRun()
+{
+    streamChips.clear();
+
+    for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; stream++)
+    {
+        if (dataStreamEnabled[stream] == 0)
+            continue;
+
+        StreamChip chip;
+        chip.boardStream = stream;
+        chip.port = stream / 4;
+        chip.registers = registers[stream].data();
+
+        const int chipId = headstageChips[stream / 2];
+
+        if ((stream & 1) == 0 || chipId == chipIdRhd2164)
+            chip.chipId = chipId;
+
+        const int delay = cableDelay[chip.port];
+        const int nominal = nominalDelays[chip.port];
+        chip.delayError = delay < nominal - 1 ? -1 : (delay > nominal + 1 ? 1 : 0);
+
+        for (int channel = 0; channel < 32; channel++)
+        {
+            const int index = stream * 32 + channel;
+            chip.signalStarts[channel] = (index % numSignals) * signalLength;
+            chip.signalPhases[channel] = (int) ((index * 7919LL) % signalLength);
+        }
+
+        streamChips.push_back (chip);
+    }
+}
+
+int EmulatorBoard::getCommandIndex (int slot, int64_t t) const
+{
+    const int loopIndex = commandLoopIndex[slot];
+    const int endIndex = commandEndIndex[slot];
+
+    if (t <= endIndex)
+        return (int) t;
+
+    // after the end of the list the board goes back to the loop index
+    if (endIndex < loopIndex)
+        return loopIndex;
+
+    return loopIndex + (int) ((t - endIndex - 1) % (endIndex - loopIndex + 1));
+}
+
+uint16_t EmulatorBoard::getAmplifierWord (const StreamChip& chip, int channel, int64_t t) const
+{
+    return signals[chip.signalStarts[channel] + (size_t) ((t + chip.signalPhases[channel]) % signalLength)];
+}
+
+uint16_t EmulatorBoard::executeCommand (StreamChip& chip, int command, int64_t t)
+{
+    const int reg = (command >> 8) & 0x3f;
+
+    switch (command >> 14)
+    {
+        case 0: // convert
+        {
+            if (reg < 32)
+                return getAmplifierWord (chip, reg, t);
+
+            const double seconds = t / getSampleRate();
+
+            if (reg <= 34) // auxiliary inputs: 1.65 V +/- 0.5 V at 1, 2 and 3 Hz
+                return (uint16_t) ((1.65 + 0.5 * std::sin (2.0 * pi * (reg - 31) * seconds)) / 0.0000374);
+
+            if (reg == 48) // supply voltage, 3.3 V
+                return (uint16_t) (3.3 / 0.0000748);
+
+            if (reg == 49) // temperature sensor
+                return 21000;
+
+            return 0;
+        }
+
+        case 1: // calibrate or clear calibration
+            return command == 0x5500 ? 0x8000 : 0x0000;
+
+        case 2: // register write
+            if (reg < 22)
+                chip.registers[reg] = (uint8_t) (command & 0xff);
+
+            return (uint16_t) (0xff00 | (command & 0xff));
+
+        default: // register read
+            return chip.registers[reg];
+    }
+}
+
+uint16_t EmulatorBoard::applyDelayError (uint16_t word, int delayError)
+{
+    // sampling the MISO line a clock early or late shifts every bit
+    if (delayError < 0)
+        return (uint16_t) (word >> 1);
+
+    if (delayError > 0)
+        return (uint16_t) ((word << 1) | 1);
+
+    return word;
+}
+
+int EmulatorBoard::generateFrames (uint16_t* dest, int64_t firstFrame, int numFrames)
+{
+    const int frameWords = getFrameWords();
+    const int numStreams = (int) streamChips.size();
+    const int rate = (int) getSampleRate();
+
+    for (int i = 0; i < numFrames; i++)
+    {
+        const int64_t t = firstFrame + i;
+        uint16_t* frame = dest + (size_t) i * frameWords;
+
+        // header magic 0xd7a22aaa38132a53 and timestamp, least significant word first
+        frame[0] = 0x2a53;
+        frame[1] = 0x3813;
+        frame[2] = 0x2aaa;
+        frame[3] = 0xd7a2;
+        frame[4] = (uint16_t) (t & 0xffff);
+        frame[5] = (uint16_t) ((t >> 16) & 0xffff);
+
+        // each frame carries the results of the aux commands sent with the previous frame
+        uint16_t* aux = frame + 6;
+
+        for (int slot = 0; slot < 3; slot++)
+        {
+            const int commandIndex = t > 0 ? getCommandIndex (slot, t - 1) : -1;
+
+            for (int j = 0; j < numStreams; j++)
+            {
+                StreamChip& chip = streamChips[j];
+                uint16_t result = 0;
+
+                if (chip.chipId != 0 && commandIndex >= 0)
+                {
+                    const std::vector<int>& commands = commandLists[slot][commandBanks[chip.port][slot]];
+
+                    if (commandIndex < (int) commands.size())
+                        result = applyDelayError (executeCommand (chip, commands[commandIndex], t), chip.delayError);
+                }
+
+                aux[slot * numStreams + j] = result;
+            }
+        }
+
+        uint16_t* amplifiers = aux + 3 * numStreams;
+
+        for (int channel = 0; channel < 32; channel++)
+        {
+            for (int j = 0; j < numStreams; j++)
+            {
+                const StreamChip& chip = streamChips[j];
+
+                amplifiers[channel * numStreams + j] = chip.chipId != 0 ? applyDelayError (getAmplifierWord (chip, channel, t), chip.delayError) : 0;
+            }
+        }
+
+        uint16_t* filler = amplifiers + 32 * numStreams;
+
+        for (int j = 0; j < numStreams % 4; j++)
+            filler[j] = 0;
+
+        // ADC i is a full-scale sawtooth with a period of (i + 1) * 100 ms
+        uint16_t* adcs = filler + numStreams % 4;
+
+        for (int adc = 0; adc < 8; adc++)
+        {
+            const int64_t period = std::max (1, (adc + 1) * rate / 10);
+            adcs[adc] = (uint16_t) ((t % period) * 65536 / period);
+        }
+
+        // TTL input i toggles every (i + 1) * 50 ms
+        uint16_t ttlIn = 0;
+
+        for (int line = 0; line < 16; line++)
+        {
+            const int64_t halfPeriod = std::max (1, (line + 1) * rate / 20);
+
+            if ((t / halfPeriod) & 1)
+                ttlIn |= (uint16_t) (1 << line);
+        }
+
+        adcs[8] = ttlIn;
+        adcs[9] = ttlOutWord;
+    }
+
+    return numFrames;
+}
@@ -0,0 +1,141 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EMULATORBOARD_H
+#define EMULATORBOARD_H
+
+#include "VirtualBoard.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace RhythmNode
+{
+
+/**
+        Software Rhythm board with emulated RHD2000 headstages
+
+        Generates frames in the board's USB format for whatever streams are
+        enabled: header magic, timestamps, amplifier data (a sine, noise and
+        spikes, different for each channel), ADC ramps and toggling TTL
+        inputs.
+
+        The auxiliary command lists uploaded by the DeviceThread are executed
+        against a model of each chip's registers, with the result of each
+        command returned one frame later, as on the real board. Reads of the
+        ROM therefore return the "INTAN" and "RHD" bytes and chip ID that
+        scanPorts() looks for, and aux input conversions return slow sines.
+        Each port only answers at cable delays close to its nominal delay,
+        so the delay search behaves as it does with real cables.
+
+        This file does not depend on JUCE, so it can be built into standalone tools.
+    */
+class EmulatorBoard : public VirtualBoard
+{
+public:
+    explicit EmulatorBoard (bool realTime);
+
+    ~EmulatorBoard() override;
+
+    /** Connects an emulated chip to a headstage slot (0 = A1, 1 = A2, 2 = B1, ...).
+        chipId is the Intan chip ID (1 = RHD2132, 2 = RHD2216, 4 = RHD2164), or 0 to remove it */
+    void setHeadstage (int headstage, int chipId);
+
+    /** Sets the headstages from a list like "A1:RHD2164,B1:RHD2132,B2:RHD2216";
+        "all:RHD2164" fills every slot. Returns false if the list is malformed. */
+    bool setHeadstages (const std::string& spec);
+
+    /** Returns the number of emulated amplifier channels */
+    int getNumChannels() const;
+
+    /** Sets the cable delay at which a port's chips answer best; delays one step either side also work */
+    void setNominalCableDelay (BoardPort port, int delay);
+
+    void uploadCommandList (const std::vector<int>& commandList, AuxCmdSlot auxCommandSlot, int bank) override;
+    void selectAuxCommandBank (BoardPort port, AuxCmdSlot auxCommandSlot, int bank) override;
+    void selectAuxCommandLength (AuxCmdSlot auxCommandSlot, int loopIndex, int endIndex) override;
+
+    static const int numHeadstages = 16;
+    static const int numBanks = 16;
+
+protected:
+    int generateFrames (uint16_t* dest, int64_t firstFrame, int numFrames) override;
+    void startRun() override;
+
+private:
+    /** State of the chip seen on one board stream (a RHD2164 is seen on two) */
+    struct StreamChip
+    {
+        int boardStream = 0;
+        int chipId = 0;
+        int port = 0;
+
+        /** -1 if the port samples too early, 1 if too late, 0 if the cable delay is good */
+        int delayError = 0;
+
+        /** Signal used by each channel, and where in it the channel starts */
+        std::array<int, 32> signalStarts;
+        std::array<int, 32> signalPhases;
+
+        /** The chip's registers, as seen on this stream */
+        uint8_t* registers = nullptr;
+    };
+
+    /** Clears the registers seen on a board stream and fills in the ROM of the chip connected there */
+    void resetRegisters (int boardStream);
+
+    /** Builds the amplifier signal table */
+    void createSignals();
+
+    /** Returns the amplifier word of one channel at frame t */
+    uint16_t getAmplifierWord (const StreamChip& chip, int channel, int64_t t) const;
+
+    /** Executes one auxiliary command on a chip, returning its result */
+    uint16_t executeCommand (StreamChip& chip, int command, int64_t t);
+
+    /** Returns the index in an aux command list of the command sent at frame t */
+    int getCommandIndex (int slot, int64_t t) const;
+
+    /** Applies a port's sampling error to a word read from its chips */
+    static uint16_t applyDelayError (uint16_t word, int delayError);
+
+    std::array<int, numHeadstages> headstageChips;
+    std::array<std::array<uint8_t, 64>, MAX_NUM_DATA_STREAMS> registers;
+    std::array<int, MAX_NUM_SPI_PORTS> nominalDelays;
+
+    std::vector<int> commandLists[3][numBanks];
+    int commandBanks[MAX_NUM_SPI_PORTS][3];
+    int commandLoopIndex[3];
+    int commandEndIndex[3];
+
+    /** Chips seen on the enabled streams, in frame order (chipId 0 if nothing is connected) */
+    std::vector<StreamChip> streamChips;
+
+    /** Amplifier signals, signalLength words each; channels start at different offsets */
+    std::vector<uint16_t> signals;
+    int signalLength = 0;
+};
+
+} // namespace RhythmNode
+
+#endif // EMULATORBOARD_H
@@ -0,0 +1,298 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FrameDecoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace RhythmNode;
+
+namespace
+{
+const int channelsPerStream = 32;
+const int headerWords = 6; // magic number and timestamp
+
+const float amplifierScale = 0.195f; // microvolts per bit
+const float auxScale = 0.0000374f; // volts per bit
+const float adcScale = 0.0003125f; // volts per bit, +/-10.24 V range
+} // namespace
+
+DecodePlan::DecodePlan (const std::vector<StreamLayout>& streams, bool acquireAux, bool acquireAdc, bool separateAdcGroup)
+{
+    numStreams = (int) streams.size();
+    frameWords = getFrameWords (numStreams);
+
+    amplifierWordOffset = headerWords + 3 * numStreams;
+    int adcWordOffset = amplifierWordOffset + channelsPerStream * numStreams + numStreams % 4;
+    ttlInWordOffset = adcWordOffset + 8;
+
+    int channel = 0;
+    amplifiersContiguous = true;
+
+    groups.assign (streams.empty() ? 0 : streams.back().group + 1, { numStreams, numStreams, 0, true });
+
+    for (int stream = 0; stream < numStreams; stream++)
+    {
+        const StreamLayout& layout = streams[stream];
+        OutputGroup& group = groups[layout.group];
+
+        const uint32_t allChannels = layout.numChannels >= 32 ? 0xFFFFFFFF : (1u << layout.numChannels) - 1;
+        const uint32_t mask = layout.channelMask & allChannels;
+
+        if (layout.numChannels != channelsPerStream || mask != allChannels)
+        {
+            amplifiersContiguous = false;
+            group.amplifiersContiguous = false;
+        }
+
+        group.firstStream = std::min (group.firstStream, stream);
+        group.endStream = stream + 1;
+
+        streamRuns.push_back ((int) amplifierRuns.size());
+
+        // one copy per block of consecutive enabled channels
+        for (int n = 0; n < layout.numChannels;)
+        {
+            if (! (mask & (1u << n)))
+            {
+                n++;
+                continue;
+            }
+
+            int count = 1;
+            while (n + count < layout.numChannels && (mask & (1u << (n + count))))
+                count++;
+
+            amplifierRuns.push_back ({ stream * channelsPerStream + layout.firstChipChannel + n, group.numChannels, count });
+            group.numChannels += count;
+            channel += count;
+            n += count;
+        }
+    }
+
+    streamRuns.push_back ((int) amplifierRuns.size());
+
+    numAmplifierChannels = channel;
+    numAuxChannels = 0;
+
+    if (acquireAux)
+    {
+        // AuxCmd2 results (second aux slot) cycle through the three aux inputs
+        for (int stream = 0; stream < numStreams; stream++)
+        {
+            if (streams[stream].hasAux)
+            {
+                auxEntries.push_back ({ headerWords + numStreams + stream, numAuxChannels, auxScale, 32768.0f });
+                numAuxChannels += 3;
+            }
+        }
+    }
+
+    // with no amplifier streams, the ADC group (or an empty one) is the only group
+    if ((separateAdcGroup && acquireAdc) || groups.empty())
+        groups.push_back ({ numStreams, numStreams, 0, true });
+
+    adcGroup = (int) groups.size() - 1;
+
+    if (acquireAdc)
+    {
+        for (int adcChan = 0; adcChan < 8; adcChan++)
+            adcEntries.push_back ({ adcWordOffset + adcChan, groups[adcGroup].numChannels++, adcScale, 32768.0f });
+    }
+
+    numOutputChannels = 0;
+    for (const auto& group : groups)
+        numOutputChannels += group.numChannels;
+}
+
+int DecodePlan::getFrameWords (int numStreams)
+{
+    return headerWords + (3 + channelsPerStream) * numStreams + numStreams % 4 + 8 + 2;
+}
+
+int64_t DecodePlan::getTimestamp (const uint16_t* frame)
+{
+    return (int64_t) ((uint32_t) frame[4] | ((uint32_t) frame[5] << 16));
+}
+
+FrameDecoder::FrameDecoder (const DecodePlan& plan_, DecodeKernels::Level level)
+    : plan (plan_),
+      amplifierKernel (DecodeKernels::getAmplifierKernel (level, plan_.numStreams)),
+      amplifierScratch (plan_.numStreams * channelsPerStream),
+      auxLatched (plan_.auxEntries.size() * 3, 0.0f),
+      auxPhasesLatched (0)
+{
+    switch (plan.numStreams)
+    {
+        case 2:
+            decodeFunction = &FrameDecoder::decodeFramesImpl<2>;
+            amplifierFunction = &FrameDecoder::decodeAmplifiersImpl<2>;
+            break;
+        case 4:
+            decodeFunction = &FrameDecoder::decodeFramesImpl<4>;
+            amplifierFunction = &FrameDecoder::decodeAmplifiersImpl<4>;
+            break;
+        case 8:
+            decodeFunction = &FrameDecoder::decodeFramesImpl<8>;
+            amplifierFunction = &FrameDecoder::decodeAmplifiersImpl<8>;
+            break;
+        case 16:
+            decodeFunction = &FrameDecoder::decodeFramesImpl<16>;
+            amplifierFunction = &FrameDecoder::decodeAmplifiersImpl<16>;
+            break;
+        case 32:
+            decodeFunction = &FrameDecoder::decodeFramesImpl<32>;
+            amplifierFunction = &FrameDecoder::decodeAmplifiersImpl<32>;
+            break;
+        default:
+            decodeFunction = &FrameDecoder::decodeFramesImpl<0>;
+            amplifierFunction = &FrameDecoder::decodeAmplifiersImpl<0>;
+            break;
+    }
+}
+
+int FrameDecoder::decodeFrames (const uint16_t* frames, int numFrames, const long long* sampleNumbers, float* const* outputs, unsigned long long* ttl, float* auxOut, long long* auxSampleNumbers)
+{
+    return (this->*decodeFunction) (frames, numFrames, sampleNumbers, outputs, ttl, auxOut, auxSampleNumbers, true);
+}
+
+void FrameDecoder::decodeAmplifiers (const uint16_t* frames, int numFrames, float* const* outputs, int firstStream, int endStream)
+{
+    (this->*amplifierFunction) (frames, numFrames, outputs, firstStream, endStream);
+}
+
+int FrameDecoder::decodeNonAmplifiers (const uint16_t* frames, int numFrames, const long long* sampleNumbers, float* const* outputs, unsigned long long* ttl, float* auxOut, long long* auxSampleNumbers)
+{
+    return (this->*decodeFunction) (frames, numFrames, sampleNumbers, outputs, ttl, auxOut, auxSampleNumbers, false);
+}
+
+template <int NumStreams>
+void FrameDecoder::decodeAmplifiersImpl (const uint16_t* frames, int numFrames, float* const* outputs, int firstStream, int endStream)
+{
+    const int numStreams = NumStreams > 0 ? NumStreams : plan.numStreams;
+    const int frameWords = NumStreams > 0 ? DecodePlan::getFrameWords (NumStreams) : plan.frameWords;
+    const int amplifierWordOffset = headerWords + 3 * numStreams;
+
+    for (size_t g = 0; g < plan.groups.size(); g++)
+    {
+        const DecodePlan::OutputGroup& group = plan.groups[g];
+        const int first = std::max (firstStream, group.firstStream);
+        const int end = std::min (endStream, group.endStream);
+
+        if (first >= end)
+            continue;
+
+        // all amplifier channels of the run in one kernel call when they map straight to the output
+        if (group.amplifiersContiguous)
+        {
+            amplifierKernel (frames + amplifierWordOffset,
+                             frameWords,
+                             numStreams,
+                             first,
+                             end,
+                             numFrames,
+                             outputs[g] + (first - group.firstStream) * channelsPerStream,
+                             group.numChannels,
+                             amplifierScale);
+            continue;
+        }
+
+        // each stream only touches its own part of the scratch space, so disjoint ranges can share it
+        for (int f = 0; f < numFrames; f++)
+        {
+            const uint16_t* frame = frames + (size_t) f * frameWords;
+            float* sample = outputs[g] + (size_t) f * group.numChannels;
+
+            amplifierKernel (frame + amplifierWordOffset, 0, numStreams, first, end, 1, amplifierScratch.data() + first * channelsPerStream, 0, amplifierScale);
+
+            for (int r = plan.streamRuns[first]; r < plan.streamRuns[end]; r++)
+            {
+                const DecodePlan::CopyRun& run = plan.amplifierRuns[r];
+                memcpy (sample + run.dest, amplifierScratch.data() + run.source, run.count * sizeof (float));
+            }
+        }
+    }
+}
+
+template <int NumStreams>
+int FrameDecoder::decodeFramesImpl (const uint16_t* frames, int numFrames, const long long* sampleNumbers, float* const* outputs, unsigned long long* ttl, float* auxOut, long long* auxSampleNumbers, bool includeAmplifiers)
+{
+    const int frameWords = NumStreams > 0 ? DecodePlan::getFrameWords (NumStreams) : plan.frameWords;
+    const int ttlInWordOffset = frameWords - 2;
+    const int adcChannels = plan.groups[plan.adcGroup].numChannels;
+    int numAuxSamples = 0;
+
+    if (includeAmplifiers)
+        decodeAmplifiersImpl<NumStreams> (frames, numFrames, outputs, 0, plan.numStreams);
+
+    for (int f = 0; f < numFrames; f++)
+    {
+        const uint16_t* frame = frames + (size_t) f * frameWords;
+        float* adcSample = outputs[plan.adcGroup] + (size_t) f * adcChannels;
+
+        if (! plan.auxEntries.empty())
+        {
+            // each aux input is sampled every 4th frame; latch the new value on three
+            // phases and publish all three as one quarter-rate sample on the fourth
+            int auxPhase = (int) ((sampleNumbers[f] + 3) % 4);
+
+            if (auxPhase < 3)
+            {
+                for (size_t i = 0; i < plan.auxEntries.size(); i++)
+                {
+                    const DecodePlan::WordEntry& entry = plan.auxEntries[i];
+                    auxLatched[i * 3 + auxPhase] = (float (frame[entry.sourceWord]) - entry.offset) * entry.scale;
+                }
+
+                auxPhasesLatched |= 1 << auxPhase;
+            }
+            else
+            {
+                // skip samples missing a phase (acquisition start, or frames lost in between)
+                if (auxPhasesLatched == 7)
+                {
+                    float* dest = auxOut + (size_t) numAuxSamples * plan.numAuxChannels;
+
+                    for (size_t i = 0; i < plan.auxEntries.size(); i++)
+                    {
+                        float* channel = dest + plan.auxEntries[i].dest;
+                        channel[0] = auxLatched[i * 3];
+                        channel[1] = auxLatched[i * 3 + 1];
+                        channel[2] = auxLatched[i * 3 + 2];
+                    }
+
+                    auxSampleNumbers[numAuxSamples++] = (sampleNumbers[f] - 1) / 4;
+                }
+
+                auxPhasesLatched = 0;
+            }
+        }
+
+        for (const auto& entry : plan.adcEntries)
+            adcSample[entry.dest] = (float (frame[entry.sourceWord]) - entry.offset) * entry.scale;
+
+        ttl[f] = frame[ttlInWordOffset];
+    }
+
+    return numAuxSamples;
+}
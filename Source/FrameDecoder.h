@@ -0,0 +1,208 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAMEDECODER_H
+#define FRAMEDECODER_H
+
+#include "DecodeKernels.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace RhythmNode
+{
+
+/**
+        Describes how to turn one Rhythm USB frame into output channels
+
+        Built once when acquisition starts from the stream layout and the
+        aux/ADC settings, then never changed. All per-stream decisions
+        (chip type, 16-channel offsets, which streams carry aux inputs) are
+        resolved into flat tables here, so the decoder does no branching
+        on the channel layout.
+
+        Word offsets are in 16-bit words from the start of the frame:
+        4 words of header, 2 words of timestamp, 3 aux slots, 32 amplifier
+        channels and numStreams % 4 filler words (each slot/channel holding
+        one word per stream), 8 ADC words, then TTL in and TTL out.
+    */
+class DecodePlan
+{
+public:
+    /** Layout of one enabled data stream */
+    struct StreamLayout
+    {
+        /** Number of amplifier channels to output (32, or 16 for RHD2132 16-channel headstages) */
+        int numChannels;
+
+        /** Chip channel of the first output channel */
+        int firstChipChannel;
+
+        /** False for streams that carry no aux inputs (second stream of an RHD2164) */
+        bool hasAux;
+
+        /** Output group the stream's channels go to; groups cover consecutive streams in increasing order */
+        int group = 0;
+
+        /** Bit n set if the stream's n-th channel is output; cleared bits are skipped entirely */
+        uint32_t channelMask = 0xFFFFFFFF;
+    };
+
+    /** A separately buffered set of output channels (one per DataStream) */
+    struct OutputGroup
+    {
+        /** Data streams whose amplifier channels open the group */
+        int firstStream;
+        int endStream;
+
+        /** Channels per sample: the streams' amplifier channels, then the ADCs if this is the ADC group */
+        int numChannels;
+
+        /** True if every stream in the group outputs all 32 channels unmasked, so the kernel writes the output directly */
+        bool amplifiersContiguous;
+    };
+
+    /** Copies a run of amplifier channels from the transposed frame to the output */
+    struct CopyRun
+    {
+        int source;
+
+        /** Channel within the stream's output group */
+        int dest;
+
+        int count;
+    };
+
+    /** Converts one frame word to an output channel as (word - offset) * scale */
+    struct WordEntry
+    {
+        int sourceWord;
+        int dest;
+        float scale;
+        float offset;
+    };
+
+    /** The ADC channels follow the last group's amplifiers, or form a group of their own if separateAdcGroup is set.
+        Without streams there are no amplifier groups, so the plan has a single group */
+    DecodePlan (const std::vector<StreamLayout>& streams, bool acquireAux, bool acquireAdc, bool separateAdcGroup = false);
+
+    /** Returns the number of words in one frame for a number of data streams */
+    static int getFrameWords (int numStreams);
+
+    /** Reads the sample number from a frame */
+    static int64_t getTimestamp (const uint16_t* frame);
+
+    int numStreams;
+    int frameWords;
+    int numAmplifierChannels;
+
+    /** Channels per sample across all output groups */
+    int numOutputChannels;
+
+    /** Channels per sample in the quarter-rate aux output (3 per aux stream) */
+    int numAuxChannels;
+
+    int amplifierWordOffset;
+    int ttlInWordOffset;
+
+    /** Output groups in DataStream order; a single group unless streams were assigned to several */
+    std::vector<OutputGroup> groups;
+    int adcGroup;
+
+    /** True if every stream outputs all 32 channels */
+    bool amplifiersContiguous;
+
+    /** Runs of consecutive enabled channels, in stream order */
+    std::vector<CopyRun> amplifierRuns;
+
+    /** Index of each stream's first run in amplifierRuns (numStreams + 1 entries) */
+    std::vector<int> streamRuns;
+
+    /** Aux inputs (AuxCmd2 words), latched over four frames; dest is the first of 3 consecutive aux outputs */
+    std::vector<WordEntry> auxEntries;
+
+    /** Board ADC channels */
+    std::vector<WordEntry> adcEntries;
+};
+
+/**
+        Decodes frames according to a DecodePlan
+
+        Holds the state that carries over between frames (the aux
+        latches) and the scratch space for the amplifier kernel.
+        The decoder body is compiled separately for 2, 4, 8, 16 and 32
+        streams and chosen once on construction; other counts use a
+        generic version.
+    */
+class FrameDecoder
+{
+public:
+    FrameDecoder (const DecodePlan& plan, DecodeKernels::Level level = DecodeKernels::getBestLevel());
+
+    /** Decodes numFrames consecutive frames. sampleNumbers holds each frame's timestamp;
+        outputs[g] receives plan.groups[g].numChannels values per frame (sample-major) and
+        ttl one TTL input word per frame. Sample numbers and TTL words use the same types as
+        the DataBuffer's int64 and uint64.
+
+        Aux inputs are only sampled every 4th frame, so they come out at a quarter of
+        the rate: each complete set goes to auxOut (plan.numAuxChannels values) with
+        its quarter-rate sample number in auxSampleNumbers. Aux sample k holds the
+        values latched in frames 4k + 1 to 4k + 3. Room is needed for numFrames / 4 + 1
+        aux samples; returns the number written. */
+    int decodeFrames (const uint16_t* frames, int numFrames, const long long* sampleNumbers, float* const* outputs, unsigned long long* ttl, float* auxOut, long long* auxSampleNumbers);
+
+    /** Decodes only the amplifier channels of streams firstStream to endStream - 1.
+        Calls for disjoint stream ranges write disjoint channels of the outputs and may run
+        concurrently, as long as decodeNonAmplifiers() is called once for the same frames. */
+    void decodeAmplifiers (const uint16_t* frames, int numFrames, float* const* outputs, int firstStream, int endStream);
+
+    /** Decodes the aux, ADC and TTL input words of each frame (everything decodeFrames
+        does except the amplifier channels). Updates the aux latches, so only
+        one thread may call this at a time. */
+    int decodeNonAmplifiers (const uint16_t* frames, int numFrames, const long long* sampleNumbers, float* const* outputs, unsigned long long* ttl, float* auxOut, long long* auxSampleNumbers);
+
+    const DecodePlan& getPlan() const { return plan; }
+
+private:
+    /** Decoder body; NumStreams > 0 fixes the frame layout at compile time, 0 reads it from the plan */
+    template <int NumStreams>
+    int decodeFramesImpl (const uint16_t* frames, int numFrames, const long long* sampleNumbers, float* const* outputs, unsigned long long* ttl, float* auxOut, long long* auxSampleNumbers, bool includeAmplifiers);
+
+    template <int NumStreams>
+    void decodeAmplifiersImpl (const uint16_t* frames, int numFrames, float* const* outputs, int firstStream, int endStream);
+
+    typedef int (FrameDecoder::*DecodeFunction) (const uint16_t*, int, const long long*, float* const*, unsigned long long*, float*, long long*, bool);
+    typedef void (FrameDecoder::*AmplifierFunction) (const uint16_t*, int, float* const*, int, int);
+
+    const DecodePlan plan;
+    DecodeKernels::AmplifierKernel amplifierKernel;
+    DecodeFunction decodeFunction;
+    AmplifierFunction amplifierFunction;
+
+    std::vector<float> amplifierScratch;
+    std::vector<float> auxLatched;
+    int auxPhasesLatched;
+};
+
+} // namespace RhythmNode
+
+#endif // FRAMEDECODER_H
@@ -129,6 +129,53 @@ bool Headstage::isConnected() const
     return (numStreams > 0);
 }
 
+void Headstage::setChannelEnabled (int ch, bool enabled)
+{
+    if (ch > -1 && ch < getNumChannels())
+        disabledChannels.setBit (ch, ! enabled);
+}
+
+bool Headstage::isChannelEnabled (int ch) const
+{
+    return ! disabledChannels[ch];
+}
+
+int Headstage::getNumEnabledChannels() const
+{
+    int numEnabled = 0;
+
+    for (int ch = 0; ch < getNumActiveChannels(); ch++)
+    {
+        if (isChannelEnabled (ch))
+            numEnabled++;
+    }
+
+    return numEnabled;
+}
+
+uint32 Headstage::getStreamChannelMask (int offset) const
+{
+    if (numStreams == 0)
+        return 0;
+
+    // a 64-channel headstage sends channels 0-31 on its first stream and 32-63 on its second
+    const int channelsInStream = getNumActiveChannels() / numStreams;
+    uint32 mask = 0;
+
+    for (int n = 0; n < channelsInStream; n++)
+    {
+        if (isChannelEnabled (offset * channelsInStream + n))
+            mask |= (uint32) 1 << n;
+    }
+
+    return mask;
+}
+
+int Headstage::getChipChannel (int ch) const
+{
+    return halfChannels ? ch + RHD2132_16CH_OFFSET : ch;
+}
+
 String Headstage::getChannelName (int ch) const
 {
     String name;
@@ -189,8 +236,25 @@ void Headstage::setImpedances (Impedances& impedances)
 {
     impedanceMagnitudes.clear();
     impedancePhases.clear();
+    sweepMagnitudes.clear();
+    sweepPhases.clear();
+
+    const int numValues = impedances.streams.size();
 
-    for (int i = 0; i < impedances.streams.size(); i++)
+    for (int f = 0; f < impedances.frequencies.size(); f++)
+    {
+        for (int i = 0; i < numValues; i++)
+        {
+            if (impedances.streams[i] == streamIndex
+                || (numStreams == 2 && impedances.streams[i] == streamIndex + 1))
+            {
+                sweepMagnitudes.add (impedances.sweepMagnitudes[f * numValues + i]);
+                sweepPhases.add (impedances.sweepPhases[f * numValues + i]);
+            }
+        }
+    }
+
+    for (int i = 0; i < numValues; i++)
     {
         if (impedances.streams[i] == streamIndex)
         {
@@ -219,5 +283,25 @@ float Headstage::getImpedancePhase (int channel) const
     if (channel < impedancePhases.size())
         return impedancePhases[channel];
 
+    return 0.0f;
+}
+
+float Headstage::getImpedanceMagnitude (int channel, int frequencyIndex) const
+{
+    const int index = frequencyIndex * impedanceMagnitudes.size() + channel;
+
+    if (channel < impedanceMagnitudes.size() && index < sweepMagnitudes.size())
+        return sweepMagnitudes[index];
+
+    return 0.0f;
+}
+
+float Headstage::getImpedancePhase (int channel, int frequencyIndex) const
+{
+    const int index = frequencyIndex * impedancePhases.size() + channel;
+
+    if (channel < impedancePhases.size() && index < sweepPhases.size())
+        return sweepPhases[index];
+
     return 0.0f;
 }
\ No newline at end of file
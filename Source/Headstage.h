@@ -111,6 +111,26 @@ public:
     /** Returns true if the headstage is in half-channels mode */
     bool getHalfChannels() { return halfChannels; }
 
+    /** Enables or disables a channel (index among the active channels); disabled
+        channels are left out of the decode and the published channel list */
+    void setChannelEnabled (int ch, bool enabled);
+
+    /** Returns true if a channel is enabled*/
+    bool isChannelEnabled (int ch) const;
+
+    /** Enables all channels*/
+    void enableAllChannels() { disabledChannels.clear(); }
+
+    /** Returns the number of enabled channels out of the active channels*/
+    int getNumEnabledChannels() const;
+
+    /** Returns the enabled channels of one of this headstage's data streams (offset = 0 or 1),
+        bit n standing for the n-th channel the stream outputs */
+    uint32 getStreamChannelMask (int offset) const;
+
+    /** Returns the amplifier (register) index on the chip for an active channel */
+    int getChipChannel (int ch) const;
+
     /** Auto-generates the channel names, based on the naming scheme*/
     void generateChannelNames();
 
@@ -123,6 +143,12 @@ public:
     /** Returns the impedance phase for a channel (if it exists)*/
     float getImpedancePhase (int channel) const;
 
+    /** Returns the impedance magnitude for a channel at one test frequency of a sweep*/
+    float getImpedanceMagnitude (int channel, int frequencyIndex) const;
+
+    /** Returns the impedance phase for a channel at one test frequency of a sweep*/
+    float getImpedancePhase (int channel, int frequencyIndex) const;
+
     /** Returns true if impedance has been measured*/
     bool hasImpedanceData() const { return impedanceMagnitudes.size() > 0; }
 
@@ -144,9 +170,16 @@ private:
     StringArray channelNames;
     String prefix;
 
+    /** Active channels that have been disabled */
+    BigInteger disabledChannels;
+
     Array<float> impedanceMagnitudes;
     Array<float> impedancePhases;
 
+    /** Sweep values, frequency-major (frequencyIndex * impedanceMagnitudes.size() + channel) */
+    Array<float> sweepMagnitudes;
+    Array<float> sweepPhases;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Headstage);
 };
 
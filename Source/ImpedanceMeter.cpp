@@ -23,6 +23,9 @@
 
 #include "ImpedanceMeter.h"
 
+#include <functional>
+#include <future>
+
 using namespace RhythmNode;
 
 #define PI 3.14159265359
@@ -30,38 +33,12 @@ using namespace RhythmNode;
 #define DEGREES_TO_RADIANS 0.0174532925199
 #define RADIANS_TO_DEGREES 57.2957795132
 
-// Allocates memory for a 3-D array of doubles.
-void allocateDoubleArray3D (std::vector<std::vector<std::vector<double>>>& array3D,
-                            int xSize,
-                            int ySize,
-                            int zSize)
-{
-    int i, j;
-
-    if (xSize == 0)
-        return;
-    array3D.resize (xSize);
-    for (i = 0; i < xSize; ++i)
-    {
-        array3D[i].resize (ySize);
-        for (j = 0; j < ySize; ++j)
-        {
-            array3D[i][j].resize (zSize);
-        }
-    }
-}
-
 ImpedanceMeter::ImpedanceMeter (DeviceThread* board_) : ThreadWithProgressWindow (
                                                             "RHD2000 Impedance Measurement",
                                                             true,
                                                             true),
                                                         board (board_)
 {
-    // to perform electrode impedance measurements at very low frequencies.
-    const int maxNumBlocks = 120;
-    int numStreams = 32;
-
-    allocateDoubleArray3D (amplifierPreFilter, numStreams, 32, SAMPLES_PER_DATA_BLOCK * maxNumBlocks);
 }
 
 ImpedanceMeter::~ImpedanceMeter()
@@ -135,49 +112,104 @@ float ImpedanceMeter::updateImpedanceFrequency (float desiredImpedanceFreq, bool
     return actualImpedanceFreq;
 }
 
-int ImpedanceMeter::loadAmplifierData (std::queue<Rhd2000DataBlockUsb3>& dataQueue,
-                                       int numBlocks,
-                                       int numDataStreams)
+void ImpedanceMeter::prepareBuffers (int numStreams, int numBlocks)
 {
-    int block, t, channel, stream;
-    int indexAmp = 0;
+    // pad rows to whole 64-byte lines so every row starts aligned
+    const int stride = (SAMPLES_PER_DATA_BLOCK * numBlocks + 15) & ~15;
+    const size_t size = (size_t) numStreams * 32 * stride;
 
-    for (block = 0; block < numBlocks; ++block)
+    if (size > sampleStoreSize)
     {
-        // Load and scale RHD2000 amplifier waveforms
-        // (sampled at amplifier sampling rate)
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t)
+        sampleStore.allocate (size + 16, false);
+        sampleStoreSize = size;
+        samples = (float*) (((uintptr_t) sampleStore.getData() + 63) & ~(uintptr_t) 63);
+    }
+
+    sampleStride = stride;
+
+    const size_t rawSize = (size_t) numBlocks * Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords (numStreams);
+
+    if (rawSize > rawFramesSize)
+    {
+        rawFrames[0].allocate (rawSize, false);
+        rawFrames[1].allocate (rawSize, false);
+        rawFramesSize = rawSize;
+    }
+}
+
+void ImpedanceMeter::loadAmplifierData (const uint16* frames,
+                                        int numBlocks,
+                                        int numDataStreams)
+{
+    const size_t frameWords = Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords (numDataStreams, 1);
+    const int amplifierOffset = 6 + 3 * numDataStreams; // after the magic number, timestamp and aux words
+    const int numSamples = SAMPLES_PER_DATA_BLOCK * numBlocks;
+    const int tileSamples = 16; // one 64-byte line of a row
+
+    // Amplifier words are channel-major within a frame (all streams of channel 0, then
+    // channel 1, ...). Work through a tile of frames at a time, which stays in cache,
+    // and fill one row's line for the tile before moving to the next row, so each row
+    // is written contiguously. Units are microvolts.
+    for (int tileStart = 0; tileStart < numSamples; tileStart += tileSamples)
+    {
+        const int tileEnd = jmin (numSamples, tileStart + tileSamples);
+
+        for (int channel = 0; channel < 32; ++channel)
         {
-            for (channel = 0; channel < 32; ++channel)
+            for (int stream = 0; stream < numDataStreams; ++stream)
             {
-                for (stream = 0; stream < numDataStreams; ++stream)
-                {
-                    const Rhd2000DataBlockUsb3& block = dataQueue.front();
-                    // Amplifier waveform units = microvolts
-                    amplifierPreFilter[stream][channel][indexAmp] = 0.195 * (block.amplifierDataFast[block.fastIndex (stream, channel, t)] - 32768);
-                }
+                const uint16* source = frames + amplifierOffset + channel * numDataStreams + stream;
+                float* dest = getSamples (stream, channel);
+
+                for (int t = tileStart; t < tileEnd; ++t)
+                    dest[t] = 0.195f * (float) ((int) source[t * frameWords] - 32768);
             }
-            ++indexAmp;
         }
-        // We are done with this Rhd2000DataBlock object; remove it from dataQueue
-        dataQueue.pop();
     }
+}
+
+const uint16* ImpedanceMeter::acquireZcheckChannel (int zcheckChannel, int numBlocks)
+{
+    std::vector<int> commandList;
+
+    board->chipRegisters.setZcheckChannel (zcheckChannel);
+    board->chipRegisters.createCommandListRegisterConfig (commandList, false);
+    // Upload version with no ADC calibration to AuxCmd3 RAM Bank 1.
+    board->evalBoard->uploadCommandList (commandList, Rhd2000EvalBoardUsb3::AuxCmd3, 3);
+
+    board->evalBoard->run();
+
+    // the run length is known, so sleep through most of it instead of polling the board the whole time
+    wait (jmax (0, (int) (1000.0 * SAMPLES_PER_DATA_BLOCK * numBlocks / board->settings.boardSampleRate) - 2));
+
+    while (board->evalBoard->isRunning())
+    {
+        wait (1);
+    }
+
+    uint16* frames = rawFrames[nextRawFrames];
 
-    return 0;
+    if (board->evalBoard->readDataBlocksRaw (numBlocks, (unsigned char*) frames) <= 0
+        || ! Rhd2000DataBlockUsb3::checkUsbHeader ((unsigned char*) frames, 0))
+    {
+        LOGE ("Impedance measurement: could not read the data for Zcheck channel ", zcheckChannel);
+        return nullptr;
+    }
+
+    // only switch buffers once this one holds frames that will be analysed
+    nextRawFrames ^= 1;
+
+    return frames;
 }
 
 void ImpedanceMeter::measureComplexAmplitude (
-    std::vector<std::vector<std::vector<double>>>& measuredMagnitude,
-    std::vector<std::vector<std::vector<double>>>& measuredPhase,
     int capIndex,
     int stream,
     int chipChannel,
     int numBlocks,
-    double sampleRate,
-    double frequency,
     int numPeriods)
 {
-    int period = (sampleRate / frequency);
+    int period = (int) referenceCos.size();
     int startIndex = 0;
     int endIndex = startIndex + numPeriods * period - 1;
 
@@ -191,33 +223,56 @@ void ImpedanceMeter::measureComplexAmplitude (
     double iComponent, qComponent;
 
     // Measure real (iComponent) and imaginary (qComponent) amplitude of frequency component.
-    amplitudeOfFreqComponent (iComponent, qComponent, amplifierPreFilter[stream][chipChannel], startIndex, endIndex, sampleRate, frequency);
+    amplitudeOfFreqComponent (iComponent, qComponent, getSamples (stream, chipChannel) + startIndex, numPeriods);
     // Calculate magnitude and phase from real (I) and imaginary (Q) components.
-    measuredMagnitude[stream][chipChannel][capIndex] =
+    measuredMagnitude[getResultIndex (stream, chipChannel, capIndex)] =
         sqrt (iComponent * iComponent + qComponent * qComponent);
-    measuredPhase[stream][chipChannel][capIndex] =
+    measuredPhase[getResultIndex (stream, chipChannel, capIndex)] =
         RADIANS_TO_DEGREES * atan2 (qComponent, iComponent);
 }
 
+void ImpedanceMeter::createReferenceTables (int period)
+{
+    referenceCos.resize (period);
+    referenceSin.resize (period);
+    foldedPeriod.resize (period);
+
+    for (int t = 0; t < period; ++t)
+    {
+        referenceCos[t] = cos (TWO_PI * t / period);
+        referenceSin[t] = sin (TWO_PI * t / period);
+    }
+}
+
 void ImpedanceMeter::amplitudeOfFreqComponent (
     double& realComponent,
     double& imagComponent,
-    const std::vector<double>& data,
-    int startIndex,
-    int endIndex,
-    double sampleRate,
-    double frequency)
+    const float* data,
+    int numPeriods)
 {
-    int length = endIndex - startIndex + 1;
-    const double k = TWO_PI * frequency / sampleRate; // precalculate for speed
+    const int period = (int) referenceCos.size();
+    const int length = numPeriods * period;
+    double* folded = foldedPeriod.data();
+
+    // The references repeat every period, so sum the periods of data first (independent
+    // adds, which vectorise) and correlate that single period with the tables.
+    std::fill (foldedPeriod.begin(), foldedPeriod.end(), 0.0);
+
+    for (int p = 0; p < numPeriods; ++p)
+    {
+        const float* periodData = data + (size_t) p * period;
+
+        for (int t = 0; t < period; ++t)
+            folded[t] += periodData[t];
+    }
 
     // Perform correlation with sine and cosine waveforms.
     double meanI = 0.0;
     double meanQ = 0.0;
-    for (int t = startIndex; t <= endIndex; ++t)
+    for (int t = 0; t < period; ++t)
     {
-        meanI += data.at (t) * cos (k * t);
-        meanQ += data.at (t) * -1.0 * sin (k * t);
+        meanI += folded[t] * referenceCos[t];
+        meanQ -= folded[t] * referenceSin[t];
     }
     meanI /= (double) length;
     meanQ /= (double) length;
@@ -274,16 +329,12 @@ void ImpedanceMeter::run()
 
 void ImpedanceMeter::runImpedanceMeasurement (Impedances& impedances)
 {
-    int commandSequenceLength, stream, channel, capRange;
-    double cSeries;
+    int commandSequenceLength, stream;
     std::vector<int> commandList;
 
     setProgress (0.0f);
 
-    int numdataStreams = board->evalBoard->getNumEnabledDataStreams();
-
     bool rhd2164ChipPresent = false;
-    int chOffset;
 
     Array<int> enabledStreams;
 
@@ -302,21 +353,40 @@ void ImpedanceMeter::runImpedanceMeasurement (Impedances& impedances)
         }
     }
 
-    bool validImpedanceFreq;
-    float actualImpedanceFreq = updateImpedanceFrequency (1000.0, validImpedanceFreq);
+    // Measure at each frequency of the sweep list (1 kHz if it is empty), as corrected
+    // to a whole number of samples per period
+    Array<float> desiredFrequencies = board->settings.impedanceFrequencies;
+
+    if (desiredFrequencies.isEmpty())
+        desiredFrequencies.add (1000.0f);
+
+    Array<float> testFrequencies;
 
-    if (! validImpedanceFreq)
+    for (float desiredFrequency : desiredFrequencies)
+    {
+        bool validImpedanceFreq;
+        float actualImpedanceFreq = updateImpedanceFrequency (desiredFrequency, validImpedanceFreq);
+
+        if (! validImpedanceFreq)
+            LOGC ("Impedance test frequency ", desiredFrequency, " Hz is outside the amplifier bandwidth or sample rate limits; skipped");
+        else if (! testFrequencies.contains (actualImpedanceFreq))
+            testFrequencies.add (actualImpedanceFreq);
+    }
+
+    if (testFrequencies.isEmpty())
     {
         return;
     }
 
-    // Create a command list for the AuxCmd1 slot.
-    commandSequenceLength = board->chipRegisters.createCommandListZcheckDac (commandList, actualImpedanceFreq, 128.0);
-    CHECK_EXIT;
-    board->evalBoard->uploadCommandList (commandList, Rhd2000EvalBoardUsb3::AuxCmd1, 1);
-    board->evalBoard->selectAuxCommandLength (Rhd2000EvalBoardUsb3::AuxCmd1,
-                                              0,
-                                              commandSequenceLength - 1);
+    // the channel impedances are reported at the standard 1 kHz, or the nearest test frequency to it
+    int primaryIndex = 0;
+
+    for (int i = 1; i < testFrequencies.size(); ++i)
+        if (std::abs (log (testFrequencies[i] / 1000.0f)) < std::abs (log (testFrequencies[primaryIndex] / 1000.0f)))
+            primaryIndex = i;
+
+    if (testFrequencies.size() > 1)
+        LOGC ("Impedance sweep: channel impedances are reported at ", testFrequencies[primaryIndex], " Hz");
 
     if (board->settings.fastTTLSettleEnabled)
     {
@@ -349,15 +419,6 @@ void ImpedanceMeter::runImpedanceMeasurement (Impedances& impedances)
                                             Rhd2000EvalBoardUsb3::AuxCmd1,
                                             1);
 
-    // Select number of periods to measure impedance over
-    int numPeriods = (0.020 * actualImpedanceFreq); // Test each channel for at least 20 msec...
-    if (numPeriods < 5)
-        numPeriods = 5; // ...but always measure across no fewer than 5 complete periods
-    double period = board->settings.boardSampleRate / actualImpedanceFreq;
-    int numBlocks = ceil ((numPeriods + 2.0) * period / 60.0); // + 2 periods to give time to settle initially
-    if (numBlocks < 2)
-        numBlocks = 2; // need first block for command to switch channels to take effect.
-
     CHECK_EXIT;
     board->settings.dsp.cutoffFreq = board->chipRegisters.setDspCutoffFreq (board->settings.dsp.cutoffFreq);
     board->settings.dsp.lowerBandwidth = board->chipRegisters.setLowerBandwidth (board->settings.dsp.lowerBandwidth);
@@ -381,28 +442,94 @@ void ImpedanceMeter::runImpedanceMeasurement (Impedances& impedances)
 
     CHECK_EXIT;
     board->evalBoard->setContinuousRunMode (false);
-    board->evalBoard->setMaxTimeStep (SAMPLES_PER_DATA_BLOCK * numBlocks);
 
-    // Create matrices of doubles of size (numStreams x 32 x 3) to store complex amplitudes
-    // of all amplifier channels (32 on each data stream) at three different Cseries values.
-    std::vector<std::vector<std::vector<double>>> measuredMagnitude;
-    std::vector<std::vector<std::vector<double>>> measuredPhase;
+    // the last measurement is only a useful prior while each stream index still means the same site
+    const Array<int> streamLayout = board->getStreamLayout();
+    const Impedances noPrior;
+    const Impedances& prior = impedances.streamLayout == streamLayout ? impedances : noPrior;
 
-    measuredMagnitude.resize (board->evalBoard->getNumEnabledDataStreams());
-    measuredPhase.resize (board->evalBoard->getNumEnabledDataStreams());
+    Impedances results;
+    Impedances previousPoint;
 
-    for (int i = 0; i < board->evalBoard->getNumEnabledDataStreams(); ++i)
+    for (int i = 0; i < testFrequencies.size(); ++i)
     {
-        measuredMagnitude[i].resize (32);
-        measuredPhase[i].resize (32);
-
-        for (int j = 0; j < 32; ++j)
+        Impedances point;
+
+        // the adaptive sweep guesses each site's impedance from the previous frequency, or the last measurement
+        if (! measureAtFrequency (testFrequencies[i],
+                                  rhd2164ChipPresent,
+                                  i == 0 ? prior : previousPoint,
+                                  point,
+                                  float (i) / float (testFrequencies.size()),
+                                  1.0f / float (testFrequencies.size())))
+            return;
+
+        if (i == primaryIndex)
         {
-            measuredMagnitude[i][j].resize (3);
-            measuredPhase[i][j].resize (3);
+            results.primaryFrequency = testFrequencies[i];
+            results.streams = point.streams;
+            results.channels = point.channels;
+            results.magnitudes = point.magnitudes;
+            results.phases = point.phases;
         }
+
+        results.frequencies.add (testFrequencies[i]);
+        results.sweepMagnitudes.addArray (point.magnitudes);
+        results.sweepPhases.addArray (point.phases);
+
+        previousPoint = point;
     }
 
+    results.streamLayout = streamLayout;
+    results.valid = true;
+    impedances = results;
+}
+
+bool ImpedanceMeter::measureAtFrequency (float actualImpedanceFreq,
+                                         bool rhd2164ChipPresent,
+                                         const Impedances& expectedImpedances,
+                                         Impedances& impedances,
+                                         float progressStart,
+                                         float progressSpan)
+{
+    int commandSequenceLength, stream, channel, capRange, chOffset;
+    std::vector<int> commandList;
+
+    const int numdataStreams = board->evalBoard->getNumEnabledDataStreams();
+
+    // Create a command list for the AuxCmd1 slot.
+    commandSequenceLength = board->chipRegisters.createCommandListZcheckDac (commandList, actualImpedanceFreq, 128.0);
+
+    if (threadShouldExit())
+        return false;
+
+    board->evalBoard->uploadCommandList (commandList, Rhd2000EvalBoardUsb3::AuxCmd1, 1);
+    board->evalBoard->selectAuxCommandLength (Rhd2000EvalBoardUsb3::AuxCmd1,
+                                              0,
+                                              commandSequenceLength - 1);
+
+    // Select number of periods to measure impedance over
+    int numPeriods = (0.020 * actualImpedanceFreq); // Test each channel for at least 20 msec...
+    if (numPeriods < 5)
+        numPeriods = 5; // ...but always measure across no fewer than 5 complete periods
+    double period = board->settings.boardSampleRate / actualImpedanceFreq;
+    createReferenceTables (roundToInt (period));
+    int numBlocks = ceil ((numPeriods + 2.0) * period / 60.0); // + 2 periods to give time to settle initially
+    if (numBlocks < 2)
+        numBlocks = 2; // need first block for command to switch channels to take effect.
+
+    if (threadShouldExit())
+        return false;
+
+    board->evalBoard->setMaxTimeStep (SAMPLES_PER_DATA_BLOCK * numBlocks);
+
+    // Complex amplitudes of all amplifier channels (32 on each data stream) at three different
+    // Cseries values; a negative magnitude marks a range that was not measured (adaptive
+    // sweeps skip some). The buffers keep their capacity from one measurement to the next.
+    prepareBuffers (numdataStreams, numBlocks);
+    measuredMagnitude.assign ((size_t) numdataStreams * 32 * 3, -1.0f);
+    measuredPhase.assign ((size_t) numdataStreams * 32 * 3, 0.0f);
+
     double distance, minDistance, current, Cseries;
     double impedanceMagnitude, impedancePhase;
 
@@ -415,91 +542,243 @@ void ImpedanceMeter::runImpedanceMeasurement (Impedances& impedances)
 
     int bestAmplitudeIndex;
 
-    // We execute three complete electrode impedance measurements: one each with
-    // Cseries set to 0.1 pF, 1 pF, and 10 pF.  Then we select the best measurement
-    // for each channel so that we achieve a wide impedance measurement range.
-    for (capRange = 0; capRange < 3; ++capRange)
+    // Analysis runs on a worker thread, one acquisition behind: while channel N is
+    // analysed, the board is already acquiring channel N + 1. The worker is the only
+    // user of the sample store, and only one analysis is in flight at a time.
+    auto analyse = [this, numdataStreams, numBlocks, numPeriods] (const uint16* frames, int capIndex, int chipChannel, bool rhd2164B)
     {
-        switch (capRange)
+        loadAmplifierData (frames, numBlocks, numdataStreams);
+
+        for (int s = 0; s < numdataStreams; ++s)
         {
-            case 0:
-                board->chipRegisters.setZcheckScale (Rhd2000RegistersUsb3::ZcheckCs100fF);
-                cSeries = 0.1e-12;
-                break;
-            case 1:
-                board->chipRegisters.setZcheckScale (Rhd2000RegistersUsb3::ZcheckCs1pF);
-                cSeries = 1.0e-12;
-                break;
-            case 2:
-                board->chipRegisters.setZcheckScale (Rhd2000RegistersUsb3::ZcheckCs10pF);
-                cSeries = 10.0e-12;
-                break;
+            if ((board->chipId[s] == CHIP_ID_RHD2164_B) == rhd2164B)
+                measureComplexAmplitude (capIndex, s, chipChannel, numBlocks, numPeriods);
+        }
+    };
+
+    // declared after everything the analysis uses, so an early return waits for it before those go away
+    std::future<void> pendingAnalysis;
+
+    int stepsPlanned = 0;
+    int stepsDone = 0;
+    int64 channelsMeasured = 0;
+    double analysisWaitSeconds = 0.0;
+    const int64 startTicks = Time::getHighResolutionTicks();
+
+    auto submitAnalysis = [&] (const uint16* frames, int capIndex, int chipChannel, bool rhd2164B)
+    {
+        const int64 waitTicks = Time::getHighResolutionTicks();
+
+        if (pendingAnalysis.valid())
+            pendingAnalysis.get();
+
+        analysisWaitSeconds += Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - waitTicks);
+
+        pendingAnalysis = std::async (std::launch::async,
+                                      [&analyse, frames, capIndex, chipChannel, rhd2164B]()
+                                      { analyse (frames, capIndex, chipChannel, rhd2164B); });
+
+        for (int s = 0; s < numdataStreams; ++s)
+        {
+            if ((board->chipId[s] == CHIP_ID_RHD2164_B) == rhd2164B)
+                ++channelsMeasured;
         }
 
-        // Check all 32 channels across all active data streams.
-        for (channel = 0; channel < 32; ++channel)
+        ++stepsDone;
+        setProgress (progressStart + progressSpan * float (stepsDone) / float (jmax (1, stepsPlanned)));
+
+        const double elapsed = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks);
+
+        if (elapsed > 0.0)
+            setStatusMessage (String (actualImpedanceFreq, 0) + " Hz: " + String (channelsMeasured) + " channel measurements, " + String (channelsMeasured / elapsed, 1) + " per second");
+    };
+
+    // One step measures one Zcheck channel at one Cseries range on every stream at once;
+    // half 1 addresses channels 32-63 of RHD2164 chips (their second data stream).
+    bool stepNeeded[3][32][2];
+    const int numHalves = rhd2164ChipPresent ? 2 : 1;
+
+    auto forEachSite = [this, numdataStreams] (std::function<void (int, int, int)> callback)
+    {
+        for (int s = 0; s < numdataStreams; ++s)
         {
-            CHECK_EXIT;
+            const int offset = (board->chipId[s] == CHIP_ID_RHD2132 && board->numChannelsPerDataStream[s] == 16) ? RHD2132_16CH_OFFSET : 0;
 
-            board->chipRegisters.setZcheckChannel (channel);
-            commandSequenceLength =
-                board->chipRegisters.createCommandListRegisterConfig (commandList, false);
-            // Upload version with no ADC calibration to AuxCmd3 RAM Bank 1.
-            board->evalBoard->uploadCommandList (commandList, Rhd2000EvalBoardUsb3::AuxCmd3, 3);
+            for (int ch = 0; ch < board->numChannelsPerDataStream[s]; ++ch)
+                callback (s, ch + offset, board->chipId[s] == CHIP_ID_RHD2164_B ? 1 : 0);
+        }
+    };
 
-            board->evalBoard->run();
-            while (board->evalBoard->isRunning())
+    // Runs the steps marked in stepNeeded, grouped by range; returns false if the thread should exit
+    auto runSteps = [&]() -> bool
+    {
+        for (capRange = 0; capRange < 3; ++capRange)
+        {
+            switch (capRange)
             {
+                case 0:
+                    board->chipRegisters.setZcheckScale (Rhd2000RegistersUsb3::ZcheckCs100fF);
+                    break;
+                case 1:
+                    board->chipRegisters.setZcheckScale (Rhd2000RegistersUsb3::ZcheckCs1pF);
+                    break;
+                case 2:
+                    board->chipRegisters.setZcheckScale (Rhd2000RegistersUsb3::ZcheckCs10pF);
+                    break;
             }
-            std::queue<Rhd2000DataBlockUsb3> dataQueue;
-            board->evalBoard->readDataBlocks (numBlocks, dataQueue);
-            loadAmplifierData (dataQueue, numBlocks, numdataStreams);
 
-            for (stream = 0; stream < numdataStreams; ++stream)
+            for (channel = 0; channel < 32; ++channel)
             {
-                setProgress (float (capRange) / 3.0f
-                             + (float (channel) / 32.0f / 3.0f)
-                             + (float (stream) / float (numdataStreams) / 32.0f / 3.0f));
-
-                if (board->chipId[stream] != CHIP_ID_RHD2164_B)
+                for (int half = 0; half < numHalves; ++half)
                 {
-                    measureComplexAmplitude (measuredMagnitude, measuredPhase, capRange, stream, channel, numBlocks, board->settings.boardSampleRate, actualImpedanceFreq, numPeriods);
+                    if (! stepNeeded[capRange][channel][half])
+                        continue;
+
+                    if (threadShouldExit())
+                        return false;
+
+                    // a failed read leaves these sites unmeasured at this range (negative magnitude)
+                    if (const uint16* frames = acquireZcheckChannel (channel + 32 * half, numBlocks))
+                        submitAnalysis (frames, capRange, channel, half == 1);
                 }
             }
+        }
+
+        // the next pass decides from these results
+        if (pendingAnalysis.valid())
+            pendingAnalysis.get();
+
+        return true;
+    };
+
+    auto planSteps = [&] (std::function<int (int, int)> rangeForSite) -> int
+    {
+        int numSteps = 0;
+        memset (stepNeeded, 0, sizeof (stepNeeded));
 
-            // If an RHD2164 chip is plugged in, we have to set the Zcheck select register to channels 32-63
-            // and repeat the previous steps.
-            if (rhd2164ChipPresent)
+        forEachSite ([&] (int s, int chipChannel, int half)
+                     {
+                         const int range = rangeForSite (s, chipChannel);
+
+                         if (range >= 0 && ! stepNeeded[range][chipChannel][half])
+                         {
+                             stepNeeded[range][chipChannel][half] = true;
+                             ++numSteps;
+                         }
+                     });
+
+        stepsPlanned = stepsDone + numSteps;
+        return numSteps;
+    };
+
+    if (! board->settings.adaptiveImpedanceRanges)
+    {
+        // We execute three complete electrode impedance measurements: one each with
+        // Cseries set to 0.1 pF, 1 pF, and 10 pF.  Then we select the best measurement
+        // for each channel so that we achieve a wide impedance measurement range.
+        for (int r = 0; r < 3; ++r)
+            for (int ch = 0; ch < 32; ++ch)
+                for (int half = 0; half < 2; ++half)
+                    stepNeeded[r][ch][half] = half < numHalves;
+
+        stepsPlanned = 3 * 32 * numHalves;
+
+        if (! runSteps())
+            return false;
+    }
+    else
+    {
+        // Start each site at the range expected to give the amplitude closest to bestAmplitude,
+        // from its last measured impedance (or a typical electrode), then re-measure only the
+        // sites whose amplitude shows that a neighbouring range would have been closer.
+        const double typicalImpedance = 500.0e3; // ohms
+        const double cSeriesValues[3] = { 0.1e-12, 1.0e-12, 10.0e-12 };
+
+        std::vector<std::vector<double>> expectedImpedance (numdataStreams, std::vector<double> (32, typicalImpedance));
+
+        if (expectedImpedances.valid)
+        {
+            for (int i = 0; i < expectedImpedances.magnitudes.size(); ++i)
             {
-                CHECK_EXIT;
-                board->chipRegisters.setZcheckChannel (channel + 32); // address channels 32-63
-                commandSequenceLength =
-                    board->chipRegisters.createCommandListRegisterConfig (commandList, false);
-                // Upload version with no ADC calibration to AuxCmd3 RAM Bank 1.
-                board->evalBoard->uploadCommandList (commandList, Rhd2000EvalBoardUsb3::AuxCmd3, 3);
-
-                board->evalBoard->run();
-                while (board->evalBoard->isRunning())
-                {
-                }
-                board->evalBoard->readDataBlocks (numBlocks, dataQueue);
-                loadAmplifierData (dataQueue, numBlocks, numdataStreams);
+                const int s = expectedImpedances.streams[i];
+                const int chipChannel = expectedImpedances.channels[i];
 
-                for (stream = 0; stream < board->evalBoard->getNumEnabledDataStreams(); ++stream)
-                {
-                    if (board->chipId[stream] == CHIP_ID_RHD2164_B)
-                    {
-                        measureComplexAmplitude (measuredMagnitude, measuredPhase, capRange, stream, channel, numBlocks, board->settings.boardSampleRate, actualImpedanceFreq, numPeriods);
-                    }
-                }
+                if (s >= 0 && s < numdataStreams && chipChannel >= 0 && chipChannel < 32 && expectedImpedances.magnitudes[i] > 0)
+                    expectedImpedance[s][chipChannel] = expectedImpedances.magnitudes[i];
             }
         }
+
+        planSteps ([&] (int s, int chipChannel)
+                   {
+                       int bestRange = 0;
+                       double bestDistance = 9.9e99;
+
+                       for (int r = 0; r < 3; ++r)
+                       {
+                           // inverse of the magnitude calculation below, ignoring the parasitic capacitance
+                           const double current = TWO_PI * actualImpedanceFreq * dacVoltageAmplitude * cSeriesValues[r];
+                           const double amplitude = 1.0e6 * expectedImpedance[s][chipChannel] * current / (18.0 * relativeFreq * relativeFreq + 1.0);
+                           const double d = std::abs (log (amplitude / bestAmplitude));
+
+                           if (d < bestDistance)
+                           {
+                               bestRange = r;
+                               bestDistance = d;
+                           }
+                       }
+
+                       return bestRange;
+                   });
+
+        if (! runSteps())
+            return false;
+
+        // Adjacent ranges differ tenfold in current, so a neighbour can only be closer to
+        // bestAmplitude (on a log scale) if the amplitude is more than sqrt(10) away from it.
+        const double usableRatio = sqrt (10.0);
+
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            const int numSteps = planSteps ([&] (int s, int chipChannel)
+                                            {
+                                                const float* magnitudes = measuredMagnitude.data() + getResultIndex (s, chipChannel, 0);
+
+                                                int best = -1;
+                                                for (int r = 0; r < 3; ++r)
+                                                {
+                                                    if (magnitudes[r] >= 0.0 && (best < 0 || std::abs (log (magnitudes[r] / bestAmplitude)) < std::abs (log (magnitudes[best] / bestAmplitude))))
+                                                        best = r;
+                                                }
+
+                                                if (best < 0)
+                                                    return -1;
+
+                                                int next = -1;
+                                                if (magnitudes[best] < bestAmplitude / usableRatio && best < 2)
+                                                    next = best + 1;
+                                                else if (magnitudes[best] > bestAmplitude * usableRatio && best > 0)
+                                                    next = best - 1;
+
+                                                return (next >= 0 && magnitudes[next] < 0.0) ? next : -1;
+                                            });
+
+            if (numSteps == 0)
+                break;
+
+            if (! runSteps())
+                return false;
+        }
+
+        LOGC ("Adaptive impedance sweep: ", stepsDone, " of ", 3 * 32 * numHalves, " range/channel steps");
     }
 
-    impedances.streams.clear();
-    impedances.channels.clear();
-    impedances.magnitudes.clear();
-    impedances.phases.clear();
+    if (pendingAnalysis.valid())
+        pendingAnalysis.get();
+
+    const double totalSeconds = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks);
+
+    LOGC ("Impedance measurement at ", actualImpedanceFreq, " Hz: ", channelsMeasured, " channel measurements in ", totalSeconds, " s (",
+          channelsMeasured / jmax (totalSeconds, 1.0e-3), " per second), ", analysisWaitSeconds, " s waiting for analysis");
 
     for (stream = 0; stream < board->evalBoard->getNumEnabledDataStreams(); ++stream)
     {
@@ -515,8 +794,11 @@ void ImpedanceMeter::runImpedanceMeasurement (Impedances& impedances)
                 minDistance = 9.9e99; // ridiculously large number
                 for (capRange = 0; capRange < 3; ++capRange)
                 {
+                    if (measuredMagnitude[getResultIndex (stream, channel + chOffset, capRange)] < 0.0)
+                        continue;
+
                     // Find the measured amplitude that is closest to bestAmplitude on a logarithmic scale
-                    distance = abs (log (measuredMagnitude[stream][channel + chOffset][capRange] / bestAmplitude));
+                    distance = abs (log (measuredMagnitude[getResultIndex (stream, channel + chOffset, capRange)] / bestAmplitude));
                     if (distance < minDistance)
                     {
                         bestAmplitudeIndex = capRange;
@@ -540,11 +822,11 @@ void ImpedanceMeter::runImpedanceMeasurement (Impedances& impedances)
                 current = TWO_PI * actualImpedanceFreq * dacVoltageAmplitude * Cseries;
 
                 // Calculate impedance magnitude from calculated current and measured voltage.
-                impedanceMagnitude = 1.0e-6 * (measuredMagnitude[stream][channel + chOffset][bestAmplitudeIndex] / current) * (18.0 * relativeFreq * relativeFreq + 1.0);
+                impedanceMagnitude = 1.0e-6 * (measuredMagnitude[getResultIndex (stream, channel + chOffset, bestAmplitudeIndex)] / current) * (18.0 * relativeFreq * relativeFreq + 1.0);
 
                 // Calculate impedance phase, with small correction factor accounting for the
                 // 3-command SPI pipeline delay.
-                impedancePhase = measuredPhase[stream][channel + chOffset][bestAmplitudeIndex] + (360.0 * (3.0 / period));
+                impedancePhase = measuredPhase[getResultIndex (stream, channel + chOffset, bestAmplitudeIndex)] + (360.0 * (3.0 / period));
 
                 // Factor out on-chip parasitic capacitance from impedance measurement.
                 factorOutParallelCapacitance (impedanceMagnitude, impedancePhase, actualImpedanceFreq, parasiticCapacitance);
@@ -566,6 +848,8 @@ void ImpedanceMeter::runImpedanceMeasurement (Impedances& impedances)
     }
 
     impedances.valid = true;
+
+    return true;
 }
 
 void ImpedanceMeter::restoreBoardSettings()
@@ -586,14 +870,7 @@ void ImpedanceMeter::restoreBoardSettings()
 
     board->evalBoard->selectAuxCommandLength (Rhd2000EvalBoardUsb3::AuxCmd1, 0, 1);
 
-    board->evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortA, Rhd2000EvalBoardUsb3::AuxCmd3, board->settings.fastSettleEnabled ? 2 : 1);
-    board->evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortB, Rhd2000EvalBoardUsb3::AuxCmd3, board->settings.fastSettleEnabled ? 2 : 1);
-    board->evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortC, Rhd2000EvalBoardUsb3::AuxCmd3, board->settings.fastSettleEnabled ? 2 : 1);
-    board->evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortD, Rhd2000EvalBoardUsb3::AuxCmd3, board->settings.fastSettleEnabled ? 2 : 1);
-    board->evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortE, Rhd2000EvalBoardUsb3::AuxCmd3, board->settings.fastSettleEnabled ? 2 : 1);
-    board->evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortF, Rhd2000EvalBoardUsb3::AuxCmd3, board->settings.fastSettleEnabled ? 2 : 1);
-    board->evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortG, Rhd2000EvalBoardUsb3::AuxCmd3, board->settings.fastSettleEnabled ? 2 : 1);
-    board->evalBoard->selectAuxCommandBank (Rhd2000EvalBoardUsb3::PortH, Rhd2000EvalBoardUsb3::AuxCmd3, board->settings.fastSettleEnabled ? 2 : 1);
+    board->selectRegisterConfigBanks();
 
     if (board->settings.fastTTLSettleEnabled)
     {
@@ -65,32 +65,45 @@ private:
     /** Calculates impedance values for all channels*/
     void runImpedanceMeasurement (Impedances& impedances);
 
+    /** Measures all channels at one test frequency, predicting Cseries ranges from
+            expectedImpedances in adaptive mode. Returns false if the thread was asked to exit*/
+    bool measureAtFrequency (float actualImpedanceFreq,
+                             bool rhd2164ChipPresent,
+                             const Impedances& expectedImpedances,
+                             Impedances& impedances,
+                             float progressStart,
+                             float progressSpan);
+
     /** Restores settings of device*/
     void restoreBoardSettings();
 
-    /** Returns the magnitude and phase (in degrees) of a selected frequency component (in Hz)
-	        for a selected amplifier channel on the selected USB data stream.*/
+    /** Selects a channel for the Zcheck DAC, runs the board for numBlocks data blocks
+	        and returns their raw frames. The two raw buffers are used in turn, so the
+	        frames stay valid while the next channel is acquired. Returns nullptr if the
+	        data could not be read */
+    const uint16* acquireZcheckChannel (int zcheckChannel, int numBlocks);
+
+    /** Returns the magnitude and phase (in degrees) of the test frequency component (see
+	        createReferenceTables) for a selected amplifier channel on the selected USB data stream.*/
     void measureComplexAmplitude (
-        std::vector<std::vector<std::vector<double>>>& measuredMagnitude,
-        std::vector<std::vector<std::vector<double>>>& measuredPhase,
         int capIndex,
         int stream,
         int chipChannel,
         int numBlocks,
-        double sampleRate,
-        double frequency,
         int numPeriods);
 
-    /** Returns the real and imaginary amplitudes of a selected frequency component in the vector
-		    data, between a start index and end index. */
+    /** Returns the real and imaginary amplitudes of the test frequency component in numPeriods
+		    whole periods of data, starting at a period boundary. Uses the reference tables. */
     void amplitudeOfFreqComponent (
         double& realComponent,
         double& imagComponent,
-        const std::vector<double>& data,
-        int startIndex,
-        int endIndex,
-        double sampleRate,
-        double frequency);
+        const float* data,
+        int numPeriods);
+
+    /** Builds one period of the cosine and sine references for a test frequency of
+		    sampleRate / period; the frequency divides the sample rate exactly, so the
+		    references repeat without drift and each period of data can reuse them. */
+    void createReferenceTables (int period);
 
     /** Given a measured complex impedance that is the result of an electrode impedance in parallel
 		    with a parasitic capacitance (i.e., due to the amplifier input capacitance and other
@@ -121,15 +134,43 @@ private:
         float desiredImpedanceFreq,
         bool& impedanceFreqValid);
 
-    /** Reads numBlocks blocks of raw USB data stored in a queue of Rhd2000DataBlock
-            objects, loads this data into this SignalProcessor object, scaling the raw
-			data to generate waveforms with units of volts or microvolts.*/
-    int loadAmplifierData (
-        std::queue<Rhd2000DataBlockUsb3>& dataQueue,
+    /** Transposes the amplifier words of numBlocks blocks of raw frames into the
+            sample store, scaled to microvolts */
+    void loadAmplifierData (
+        const uint16* frames,
         int numBlocks,
         int numDataStreams);
 
-    std::vector<std::vector<std::vector<double>>> amplifierPreFilter;
+    /** Sizes the sample store and the raw frame buffers for numBlocks blocks on numStreams
+            streams; they only reallocate when a measurement needs more room than the last */
+    void prepareBuffers (int numStreams, int numBlocks);
+
+    /** Returns the first sample of a channel's row in the sample store */
+    float* getSamples (int stream, int chipChannel) const { return samples + (size_t) (stream * 32 + chipChannel) * sampleStride; }
+
+    /** Returns the index of a channel's result at one Cseries range in measuredMagnitude and measuredPhase */
+    static int getResultIndex (int stream, int chipChannel, int capIndex) { return (stream * 32 + chipChannel) * 3 + capIndex; }
+
+    /** Amplifier waveforms in microvolts: one 64-byte aligned row of sampleStride samples per
+            channel, ordered by stream, then chip channel */
+    HeapBlock<float> sampleStore;
+    size_t sampleStoreSize = 0;
+    float* samples = nullptr;
+    int sampleStride = 0;
+
+    /** Raw frames of the last two acquisitions: one is analysed while the other fills */
+    HeapBlock<uint16> rawFrames[2];
+    size_t rawFramesSize = 0;
+    int nextRawFrames = 0;
+
+    /** Magnitude and phase (degrees) of each channel at each Cseries range, see getResultIndex */
+    std::vector<float> measuredMagnitude;
+    std::vector<float> measuredPhase;
+
+    /** One period of cos and sin at the test frequency, and the measurement window folded onto one period */
+    std::vector<double> referenceCos;
+    std::vector<double> referenceSin;
+    std::vector<double> foldedPeriod;
 
     DeviceThread* board;
 
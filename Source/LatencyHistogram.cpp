@@ -0,0 +1,117 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LatencyHistogram.h"
+
+using namespace RhythmNode;
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto& bin : bins)
+        bin.store (0, std::memory_order_relaxed);
+
+    numSamples.store (0, std::memory_order_relaxed);
+    maxMicroseconds.store (0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::getBin (uint64 microseconds)
+{
+    if (microseconds < numLinearBins)
+        return (int) microseconds;
+
+    // shift the value down until it lies in [32, 64): the shift picks the octave, the rest the bin within it
+    int shift = 1;
+    while ((microseconds >> shift) >= 2 * binsPerOctave)
+        shift++;
+
+    return jmin (numBins - 1, numLinearBins + (shift - 1) * binsPerOctave + (int) (microseconds >> shift) - binsPerOctave);
+}
+
+double LatencyHistogram::getBinCentre (int bin)
+{
+    if (bin < numLinearBins)
+        return (double) bin;
+
+    const int shift = (bin - numLinearBins) / binsPerOctave + 1;
+    const int step = (bin - numLinearBins) % binsPerOctave + binsPerOctave;
+
+    return ((double) step + 0.5) * (double) ((uint64) 1 << shift);
+}
+
+void LatencyHistogram::addSample (double seconds)
+{
+    const uint64 microseconds = (uint64) jmax (0.0, seconds * 1.0e6);
+
+    bins[getBin (microseconds)].fetch_add (1, std::memory_order_relaxed);
+    numSamples.fetch_add (1, std::memory_order_relaxed);
+
+    if (microseconds > maxMicroseconds.load (std::memory_order_relaxed))
+        maxMicroseconds.store (microseconds, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::addSampleSince (int64 startTicks)
+{
+    addSample (Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks));
+}
+
+double LatencyHistogram::getPercentile (double fraction) const
+{
+    const int64 total = getNumSamples();
+
+    if (total == 0)
+        return 0.0;
+
+    // rank of the value asked for, counting from 1
+    const int64 rank = jmax ((int64) 1, (int64) std::ceil (jlimit (0.0, 1.0, fraction) * (double) total));
+    int64 count = 0;
+
+    for (int bin = 0; bin < numBins; bin++)
+    {
+        count += bins[bin].load (std::memory_order_relaxed);
+
+        if (count >= rank)
+            return jmin (getBinCentre (bin), (double) maxMicroseconds.load (std::memory_order_relaxed)) * 1.0e-6;
+    }
+
+    return getMax();
+}
+
+double LatencyHistogram::getMax() const
+{
+    return (double) maxMicroseconds.load (std::memory_order_relaxed) * 1.0e-6;
+}
+
+String LatencyHistogram::getSummary() const
+{
+    auto toMilliseconds = [] (double seconds)
+    { return String (seconds * 1000.0, 3) + " ms"; };
+
+    return "p50 " + toMilliseconds (getPercentile (0.5))
+           + ", p99 " + toMilliseconds (getPercentile (0.99))
+           + ", max " + toMilliseconds (getMax())
+           + " (" + String (getNumSamples()) + " samples)";
+}
@@ -0,0 +1,89 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <DataThreadHeaders.h>
+
+#include <atomic>
+
+namespace RhythmNode
+{
+
+/**
+        Histogram of latencies for percentile reporting
+
+        Values are binned in microseconds: exactly up to 64 us, then in 32
+        bins per power of two (about 3% resolution) up to several hours.
+        Recording costs one bin increment and no allocation, so it can run
+        on the acquisition thread for every transfer.
+
+        One thread records; any thread may read the statistics while it
+        does (they are then a recent snapshot, not an exact one).
+    */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    /** Clears all recorded values; only call while nothing is recording */
+    void reset();
+
+    /** Records one latency, in seconds */
+    void addSample (double seconds);
+
+    /** Records the time from a Time::getHighResolutionTicks() value until now */
+    void addSampleSince (int64 startTicks);
+
+    /** Returns the number of recorded values */
+    int64 getNumSamples() const { return numSamples.load (std::memory_order_relaxed); }
+
+    /** Returns the latency below which the given fraction (0 to 1) of values lie, in seconds */
+    double getPercentile (double fraction) const;
+
+    /** Returns the largest recorded latency, in seconds */
+    double getMax() const;
+
+    /** Returns "p50 ..., p99 ..., max ... (n samples)" for logging */
+    String getSummary() const;
+
+private:
+    static const int numLinearBins = 64;
+    static const int binsPerOctave = 32;
+    static const int numOctaves = 32;
+    static const int numBins = numLinearBins + numOctaves * binsPerOctave;
+
+    /** Returns the bin of a latency in microseconds */
+    static int getBin (uint64 microseconds);
+
+    /** Returns the middle of a bin, in microseconds */
+    static double getBinCentre (int bin);
+
+    std::atomic<int64> bins[numBins];
+    std::atomic<int64> numSamples;
+    std::atomic<uint64> maxMicroseconds;
+};
+
+} // namespace RhythmNode
+
+#endif // LATENCYHISTOGRAM_H
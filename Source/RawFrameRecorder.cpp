@@ -0,0 +1,138 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "RawFrameRecorder.h"
+
+using namespace RhythmNode;
+
+RawFrameRecorder::RawFrameRecorder (const File& file_, int bufferBytes)
+    : Thread ("Raw frame recorder"),
+      file (file_),
+      fifo (bufferBytes)
+{
+    file.deleteFile();
+
+    stream = std::make_unique<FileOutputStream> (file);
+
+    if (! stream->openedOk())
+    {
+        LOGE ("Could not create raw frame file ", file.getFullPathName());
+        stream.reset();
+        return;
+    }
+
+    buffer.malloc (bufferBytes);
+
+    startThread();
+}
+
+RawFrameRecorder::~RawFrameRecorder()
+{
+    close();
+}
+
+void RawFrameRecorder::write (const void* data, size_t numBytes)
+{
+    if (stream == nullptr || failed.load (std::memory_order_relaxed) || (size_t) fifo.getFreeSpace() < numBytes)
+    {
+        // stop for good rather than leave a gap in the frame stream
+        failed = true;
+        bytesDropped += (int64) numBytes;
+        return;
+    }
+
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite ((int) numBytes, start1, size1, start2, size2);
+
+    memcpy (buffer + start1, data, (size_t) size1);
+
+    if (size2 > 0)
+        memcpy (buffer + start2, static_cast<const char*> (data) + size1, (size_t) size2);
+
+    fifo.finishedWrite (size1 + size2);
+
+    notify();
+}
+
+void RawFrameRecorder::run()
+{
+    while (true)
+    {
+        const int numReady = fifo.getNumReady();
+
+        if (numReady == 0)
+        {
+            if (threadShouldExit())
+                return;
+
+            wait (10);
+            continue;
+        }
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead (numReady, start1, size1, start2, size2);
+
+        // after a failed write, the rest of the queue is discarded
+        bool ok = ! failed.load();
+
+        if (ok)
+            ok = stream->write (buffer + start1, (size_t) size1);
+
+        if (ok && size2 > 0)
+            ok = stream->write (buffer + start2, (size_t) size2);
+
+        fifo.finishedRead (size1 + size2);
+
+        if (ok)
+        {
+            bytesWritten += (int64) numReady;
+        }
+        else
+        {
+            // the disk is full or gone
+            failed = true;
+            bytesDropped += (int64) numReady;
+        }
+    }
+}
+
+void RawFrameRecorder::close()
+{
+    if (stream == nullptr)
+        return;
+
+    // the writer drains the ring before it exits
+    signalThreadShouldExit();
+    notify();
+    waitForThreadToExit (-1);
+
+    stream->flush();
+
+    // the stream's own buffer may not have fitted on the disk either
+    if (stream->getStatus().failed())
+        failed = true;
+
+    stream.reset();
+
+    if (bytesDropped.load() > 0 || failed)
+        LOGE ("Raw frame file ", file.getFullPathName(), " is incomplete, ", bytesDropped.load(), " bytes could not be written");
+}
@@ -0,0 +1,99 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAWFRAMERECORDER_H
+#define RAWFRAMERECORDER_H
+
+#include <DataThreadHeaders.h>
+
+#include <atomic>
+
+namespace RhythmNode
+{
+
+/**
+        Copies every byte read from the board's USB pipe into a file
+
+        The USBThread hands each transfer to write() as soon as it arrives,
+        before any decoding, so the file is a lossless copy of the frame
+        stream even when the processing graph falls behind. write() only
+        copies the transfer into a ring buffer; a writer thread drains the
+        ring to disk in large sequential writes, so a slow or full disk
+        never stalls the USB thread.
+
+        The file holds whole Rhythm frames back to back, in the board's
+        little-endian word order. The stream and chip layout needed to decode
+        it is stored separately (see DeviceThread::writeRawFrameHeader()).
+    */
+class RawFrameRecorder : public Thread
+{
+public:
+    /** Creates (or replaces) the file and starts the writer thread; bufferBytes is the
+        size of the ring, which covers about two seconds of 32-stream data by default */
+    RawFrameRecorder (const File& file, int bufferBytes = 128 * 1024 * 1024);
+
+    /** Closes the file */
+    ~RawFrameRecorder() override;
+
+    /** Returns true if the file could be created */
+    bool isOpen() const { return stream != nullptr; }
+
+    /** Returns the file being written */
+    const File& getFile() const { return file; }
+
+    /** Queues numBytes bytes for writing; only call from one thread. If the ring is
+        full or a write to the file failed (disk full), this and all later data is
+        dropped and counted, so the file never has a gap in the frame stream. */
+    void write (const void* data, size_t numBytes);
+
+    /** Writes out the queued data, stops the writer thread and closes the file */
+    void close();
+
+    /** Returns the number of bytes stored in the file so far */
+    int64 getBytesWritten() const { return bytesWritten.load(); }
+
+    /** Returns the number of bytes that could not be stored */
+    int64 getBytesDropped() const { return bytesDropped.load(); }
+
+    /** Writer thread */
+    void run() override;
+
+private:
+    const File file;
+
+    std::unique_ptr<FileOutputStream> stream;
+
+    HeapBlock<char> buffer;
+    AbstractFifo fifo;
+
+    /** Set once data has been dropped; everything after it is dropped too */
+    std::atomic<bool> failed { false };
+
+    std::atomic<int64> bytesWritten { 0 };
+    std::atomic<int64> bytesDropped { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE (RawFrameRecorder);
+};
+
+} // namespace RhythmNode
+
+#endif // RAWFRAMERECORDER_H
@@ -0,0 +1,254 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ReplayBoard.h"
+#include "rhythm-api/rhd2000datablockusb3.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+using namespace RhythmNode;
+
+namespace
+{
+const int timestampWord = 4;
+
+/** Returns true if the four words at w are the frame header magic, least significant word first */
+bool isHeaderAt (const uint16_t* w)
+{
+    for (int k = 0; k < 4; k++)
+        if (w[k] != (uint16_t) (RHD2000_HEADER_MAGIC_NUMBER >> (16 * k)))
+            return false;
+
+    return true;
+}
+} // namespace
+
+ReplayBoard::ReplayBoard (const std::string& path, int numStreams, AmplifierSampleRate sampleRate_, bool realTime, bool loop_)
+    : VirtualBoard (realTime),
+      file (path, std::ios::binary),
+      numFileStreams (numStreams),
+      fileSampleRate (sampleRate_),
+      loop (loop_)
+{
+    sampleRate = fileSampleRate;
+    fileFrameWords = (int) Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords (numFileStreams, 1);
+
+    if (file.is_open() && numFileStreams > 0)
+    {
+        file.seekg (0, std::ios::end);
+
+        // a capture can end part way through a frame; the partial frame is never played
+        numFileFrames = (int64_t) file.tellg() / (2 * (int64_t) fileFrameWords);
+        timestampSpan = measureTimestampSpan();
+        seekToFrame (0);
+    }
+
+    if (! isOpen())
+        std::cerr << "ReplayBoard: could not read frames from " << path << std::endl;
+}
+
+ReplayBoard::~ReplayBoard()
+{
+}
+
+bool ReplayBoard::setSampleRate (AmplifierSampleRate)
+{
+    // the recording fixes the rate
+    return VirtualBoard::setSampleRate (fileSampleRate);
+}
+
+void ReplayBoard::startRun()
+{
+    layoutMatches = isOpen() && getFrameWords() == fileFrameWords;
+
+    if (isOpen() && ! layoutMatches)
+        std::cerr << "ReplayBoard: " << getNumEnabledDataStreams() << " streams enabled, but the recording has "
+                  << numFileStreams << "; nothing will be played." << std::endl;
+
+    seekToFrame (0);
+    pass = 0;
+    hasPendingTimestamp = false;
+}
+
+uint32_t ReplayBoard::measureTimestampSpan()
+{
+    // the first and last headers are searched for, since the capture need not start on a frame
+    const int windowWords = 2 * fileFrameWords;
+    std::vector<uint16_t> window ((size_t) windowWords);
+
+    auto findHeaderTimestamp = [&] (int64_t firstWord, bool last, uint32_t& timestamp)
+    {
+        file.clear();
+        file.seekg ((std::streamoff) (firstWord * 2));
+
+        if (! file.read (reinterpret_cast<char*> (window.data()), (std::streamsize) windowWords * 2))
+            return false;
+
+        for (int j = 0; j + timestampWord + 1 < windowWords; j++)
+        {
+            const int i = last ? windowWords - timestampWord - 2 - j : j;
+
+            if (isHeaderAt (&window[(size_t) i]))
+            {
+                timestamp = (uint32_t) window[(size_t) i + timestampWord] | ((uint32_t) window[(size_t) i + timestampWord + 1] << 16);
+                return true;
+            }
+        }
+
+        return false;
+    };
+
+    uint32_t first = 0, last = 0;
+
+    if (numFileFrames >= 2
+        && findHeaderTimestamp (0, false, first)
+        && findHeaderTimestamp (numFileFrames * fileFrameWords - windowWords, true, last))
+        return last - first + 1;
+
+    return (uint32_t) numFileFrames;
+}
+
+void ReplayBoard::seekToFrame (int64_t frame)
+{
+    position = frame;
+
+    file.clear();
+    file.seekg ((std::streamoff) (position * 2 * fileFrameWords));
+}
+
+int64_t ReplayBoard::getNumFramesLeft() const
+{
+    if (! layoutMatches)
+        return 0;
+
+    return loop ? -1 : numFileFrames - position;
+}
+
+int ReplayBoard::generateFrames (uint16_t* dest, int64_t, int numFrames)
+{
+    if (! layoutMatches)
+        return 0;
+
+    int numRead = 0;
+
+    while (numRead < numFrames)
+    {
+        if (position == numFileFrames)
+        {
+            if (! loop)
+                break;
+
+            seekToFrame (0);
+            ++pass;
+        }
+
+        const int numToRead = (int) std::min ((int64_t) (numFrames - numRead), numFileFrames - position);
+        uint16_t* block = dest + (size_t) numRead * fileFrameWords;
+
+        if (! file.read (reinterpret_cast<char*> (block), (std::streamsize) numToRead * 2 * fileFrameWords))
+            break;
+
+        position += numToRead;
+        numRead += numToRead;
+
+        // the first pass plays the file's own timestamps
+        if (pass > 0)
+        {
+            const bool hadPendingTimestamp = hasPendingTimestamp;
+            const int lastPendingWord = pendingWord;
+            const uint16_t lastPendingTimestamp[2] = { pendingTimestamp[0], pendingTimestamp[1] };
+
+            hasPendingTimestamp = false;
+            offsetTimestamps (block, numToRead * fileFrameWords);
+
+            // finish a header left split at the end of the previous call
+            if (hadPendingTimestamp && block == dest)
+                for (int k = 0; k < 2; k++)
+                    if (lastPendingWord + k >= 0)
+                        block[lastPendingWord + k] = lastPendingTimestamp[k];
+        }
+    }
+
+    return numRead;
+}
+
+void ReplayBoard::offsetTimestamps (uint16_t* words, int numWords)
+{
+    // a header near the end of the block runs on into the next frame of the same pass
+    uint16_t ahead[timestampWord + 1];
+    int numAhead = 0;
+
+    if (position < numFileFrames)
+    {
+        if (file.read (reinterpret_cast<char*> (ahead), sizeof (ahead)))
+            numAhead = timestampWord + 1;
+
+        seekToFrame (position);
+    }
+
+    auto wordAt = [&] (int i) { return i < numWords ? words[i] : ahead[i - numWords]; };
+    const uint32_t offset = (uint32_t) ((uint64_t) pass * timestampSpan);
+
+    for (int i = 0; i < numWords && i + timestampWord + 1 < numWords + numAhead; i++)
+    {
+        if (wordAt (i) != (uint16_t) RHD2000_HEADER_MAGIC_NUMBER)
+            continue;
+
+        const uint16_t header[4] = { wordAt (i), wordAt (i + 1), wordAt (i + 2), wordAt (i + 3) };
+
+        if (! isHeaderAt (header))
+            continue;
+
+        const uint32_t timestamp = ((uint32_t) wordAt (i + timestampWord) | ((uint32_t) wordAt (i + timestampWord + 1) << 16)) + offset;
+        const uint16_t patched[2] = { (uint16_t) (timestamp & 0xffff), (uint16_t) (timestamp >> 16) };
+
+        for (int k = 0; k < 2; k++)
+            if (i + timestampWord + k < numWords)
+                words[i + timestampWord + k] = patched[k];
+
+        if (i + timestampWord + 1 >= numWords)
+        {
+            hasPendingTimestamp = true;
+            pendingWord = i + timestampWord - numWords;
+            pendingTimestamp[0] = patched[0];
+            pendingTimestamp[1] = patched[1];
+        }
+    }
+}
+
+void ReplayBoard::skipFrames (int64_t numFrames)
+{
+    if (! layoutMatches)
+        return;
+
+    hasPendingTimestamp = false;
+
+    if (loop)
+    {
+        pass += (position + numFrames) / numFileFrames;
+        seekToFrame ((position + numFrames) % numFileFrames);
+    }
+    else
+        seekToFrame (std::min (position + numFrames, numFileFrames));
+}
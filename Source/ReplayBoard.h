@@ -0,0 +1,115 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REPLAYBOARD_H
+#define REPLAYBOARD_H
+
+#include "VirtualBoard.h"
+
+#include <fstream>
+#include <string>
+
+namespace RhythmNode
+{
+
+/**
+        Plays back a raw frame file written by the RawFrameRecorder
+
+        The file holds the board's USB byte stream as captured, so the frames
+        go through exactly the same read, resync and decode path as live
+        data. The recorded timestamps are played unchanged, gaps included;
+        when looping, the timestamps of each later pass are offset by the
+        span of the file so they keep counting up. Only frames located by
+        their header magic are touched, so a capture that does not start on
+        a frame boundary is never corrupted. Every run starts from the
+        beginning of the file.
+
+        The stream count and sample rate come from the recording (the sidecar
+        .xml file); the enabled streams must match it. Requests for another
+        sample rate are ignored.
+    */
+class ReplayBoard : public VirtualBoard
+{
+public:
+    /** Opens a file recorded with numStreams data streams at sampleRate */
+    ReplayBoard (const std::string& path, int numStreams, AmplifierSampleRate sampleRate, bool realTime, bool loop);
+
+    ~ReplayBoard() override;
+
+    /** Returns true if the file could be opened and holds at least one frame */
+    bool isOpen() const { return numFileFrames > 0; }
+
+    /** Returns the number of data streams in each recorded frame */
+    int getNumFileStreams() const { return numFileStreams; }
+
+    /** Returns the number of whole frames in the file */
+    int64_t getNumFileFrames() const { return numFileFrames; }
+
+    bool setSampleRate (AmplifierSampleRate newSampleRate) override;
+
+protected:
+    int generateFrames (uint16_t* dest, int64_t firstFrame, int numFrames) override;
+    int64_t getNumFramesLeft() const override;
+    void skipFrames (int64_t numFrames) override;
+    void startRun() override;
+
+private:
+    /** Moves the read position to a frame index */
+    void seekToFrame (int64_t frame);
+
+    /** Returns the timestamp advance of one pass through the file */
+    uint32_t measureTimestampSpan();
+
+    /** Adds the loop offset to the timestamps of the headers that start in words,
+        a block just read from the current pass */
+    void offsetTimestamps (uint16_t* words, int numWords);
+
+    std::ifstream file;
+
+    const int numFileStreams;
+    const AmplifierSampleRate fileSampleRate;
+    const bool loop;
+
+    int fileFrameWords;
+    int64_t numFileFrames = 0;
+
+    /** Next frame to read from the file */
+    int64_t position = 0;
+
+    /** Number of times playback has wrapped to the start of the file in this run */
+    int64_t pass = 0;
+
+    uint32_t timestampSpan = 0;
+
+    /** Offset timestamp words of a header split across the end of the last block;
+        pendingWord is the index of the low word in the next block, and may be -1 */
+    bool hasPendingTimestamp = false;
+    int pendingWord = 0;
+    uint16_t pendingTimestamp[2];
+
+    /** False if the enabled streams do not match the recording; nothing is played then */
+    bool layoutMatches = false;
+};
+
+} // namespace RhythmNode
+
+#endif // REPLAYBOARD_H
@@ -36,7 +36,8 @@ ChannelComponent::ChannelComponent (ChannelList* cl,
                                                                      channelList (cl),
                                                                      channel (ch),
                                                                      name (name_),
-                                                                     gainIndex (gainIndex_)
+                                                                     gainIndex (gainIndex_),
+                                                                     isEnabled (true)
 {
     FontOptions f = FontOptions ("Inter", "Regular", 13.0f);
 
@@ -53,6 +54,12 @@ ChannelComponent::ChannelComponent (ChannelList* cl,
 
     if (type == ContinuousChannel::ELECTRODE)
     {
+        enableButton = std::make_unique<ToggleButton>();
+        enableButton->setToggleState (true, dontSendNotification);
+        enableButton->setTooltip ("Acquire this channel");
+        enableButton->addListener (this);
+        addAndMakeVisible (enableButton.get());
+
         impedanceLabel = std::make_unique<Label> ("Impedance", "? Ohm");
         impedanceLabel->setFont (FontOptions ("Fira Code", "Regular", 13.0f));
         impedanceLabel->setEditable (false);
@@ -90,12 +97,45 @@ void ChannelComponent::setImpedanceValues (float mag, float phase)
     }
 }
 
+void ChannelComponent::setChannelEnabled (bool enabled)
+{
+    isEnabled = enabled;
+
+    if (enableButton != nullptr)
+        enableButton->setToggleState (enabled, dontSendNotification);
+
+    nameLabel->setAlpha (enabled ? 1.0f : 0.4f);
+}
+
+void ChannelComponent::setToggleEnabled (bool enabled)
+{
+    if (enableButton != nullptr)
+        enableButton->setEnabled (enabled);
+}
+
+void ChannelComponent::buttonClicked (Button* button)
+{
+    if (button == enableButton.get())
+    {
+        setChannelEnabled (button->getToggleState());
+        channelList->channelEnabledChanged (this, isEnabled);
+    }
+}
+
 void ChannelComponent::resized()
 {
-    nameLabel->setBounds (0, 0, 90, 20);
+    int x = 0;
+
+    if (enableButton != nullptr)
+    {
+        enableButton->setBounds (0, 0, 20, 20);
+        x = 22;
+    }
+
+    nameLabel->setBounds (x, 0, 90, 20);
 
     if (impedanceLabel != nullptr)
     {
-        impedanceLabel->setBounds (100, 0, 130, 20);
+        impedanceLabel->setBounds (x + 100, 0, 125, 20);
     }
 }
@@ -31,7 +31,8 @@ namespace RhythmNode
 
 class ChannelList;
 
-class ChannelComponent : public Component
+class ChannelComponent : public Component,
+                         public Button::Listener
 {
 public:
     /** Constructor */
@@ -51,6 +52,18 @@ public:
     /** Updates impedance values for this channel */
     void setImpedanceValues (float mag, float phase);
 
+    /** Shows whether this channel is enabled */
+    void setChannelEnabled (bool enabled);
+
+    /** Allows or blocks changes to the enabled state (blocked during acquisition) */
+    void setToggleEnabled (bool enabled);
+
+    /** Enable toggle callback */
+    void buttonClicked (Button* button) override;
+
+    /** Returns the channel index within its headstage */
+    int getChannel() const { return channel; }
+
     /** Sets layout */
     void resized() override;
 
@@ -62,6 +75,7 @@ private:
     ChannelList* channelList;
 
     std::unique_ptr<Label> staticLabel, nameLabel, impedanceLabel;
+    std::unique_ptr<ToggleButton> enableButton;
 
     int channel;
     String name;
@@ -64,6 +64,79 @@ ChannelList::ChannelList (DeviceThread* board_, DeviceEditor* editor_) : board (
     saveImpedanceButton->setEnabled (false);
     addAndMakeVisible (saveImpedanceButton.get());
 
+    adaptiveRangesButton = std::make_unique<UtilityButton> ("Adaptive ranges");
+    adaptiveRangesButton->setRadius (3);
+    adaptiveRangesButton->setBounds (580, 10, 120, 25);
+    adaptiveRangesButton->setFont (FontOptions (14.0f));
+    adaptiveRangesButton->setClickingTogglesState (true);
+    adaptiveRangesButton->setTooltip ("Measure each site only at the current ranges expected to suit it, starting from its last impedance");
+    adaptiveRangesButton->addListener (this);
+    addAndMakeVisible (adaptiveRangesButton.get());
+
+    impedanceFrequenciesLabel = std::make_unique<Label> ("Test Hz:", "Test Hz:");
+    impedanceFrequenciesLabel->setFont (FontOptions ("Inter", "Semi Bold", 15.0f));
+    impedanceFrequenciesLabel->setEditable (false);
+    impedanceFrequenciesLabel->setBounds (710, 10, 65, 25);
+    addAndMakeVisible (impedanceFrequenciesLabel.get());
+
+    impedanceFrequencies = std::make_unique<Label> ("Impedance frequencies", "");
+    impedanceFrequencies->setFont (FontOptions ("Inter", "Regular", 14.0f));
+    impedanceFrequencies->setEditable (true, false, false);
+    impedanceFrequencies->setBounds (775, 10, 150, 25);
+    impedanceFrequencies->setTooltip ("Impedance test frequencies in Hz, comma-separated; channels show the one nearest 1 kHz");
+    impedanceFrequencies->addListener (this);
+    addAndMakeVisible (impedanceFrequencies.get());
+
+    // acquisition options, on a second row
+    streamPerHeadstageButton = std::make_unique<UtilityButton> ("Stream per headstage");
+    streamPerHeadstageButton->setRadius (3);
+    streamPerHeadstageButton->setBounds (10, 40, 160, 25);
+    streamPerHeadstageButton->setFont (FontOptions (14.0f));
+    streamPerHeadstageButton->setClickingTogglesState (true);
+    streamPerHeadstageButton->setTooltip ("Publish one data stream per headstage (plus one for the ADCs) instead of a single stream");
+    streamPerHeadstageButton->addListener (this);
+    addAndMakeVisible (streamPerHeadstageButton.get());
+
+    rawFramesButton = std::make_unique<UtilityButton> ("Record raw frames");
+    rawFramesButton->setRadius (3);
+    rawFramesButton->setBounds (180, 40, 145, 25);
+    rawFramesButton->setFont (FontOptions (14.0f));
+    rawFramesButton->setClickingTogglesState (true);
+    rawFramesButton->setTooltip ("Save a copy of everything the board sends to a directory, for offline decoding or replay");
+    rawFramesButton->addListener (this);
+    addAndMakeVisible (rawFramesButton.get());
+
+    rawFramesLabel = std::make_unique<Label> ("Raw frame directory", "");
+    rawFramesLabel->setFont (FontOptions ("Inter", "Regular", 13.0f));
+    rawFramesLabel->setEditable (false);
+    rawFramesLabel->setBounds (330, 40, 250, 25);
+    addAndMakeVisible (rawFramesLabel.get());
+
+    decodeThreadsLabel = std::make_unique<Label> ("Decode threads:", "Decode threads:");
+    decodeThreadsLabel->setFont (FontOptions ("Inter", "Semi Bold", 15.0f));
+    decodeThreadsLabel->setEditable (false);
+    decodeThreadsLabel->setBounds (590, 40, 115, 25);
+    addAndMakeVisible (decodeThreadsLabel.get());
+
+    const int numCpus = SystemStats::getNumCpus();
+
+    decodeThreads = std::make_unique<ComboBox> ("decodeThreads");
+    for (int n = 0; n < jmax (1, numCpus); n++)
+        decodeThreads->addItem (String (n), n + 1);
+    decodeThreads->setBounds (705, 40, 55, 25);
+    decodeThreads->setTooltip ("Extra threads that share the amplifier decode (0 decodes on the acquisition thread only)");
+    decodeThreads->addListener (this);
+    addAndMakeVisible (decodeThreads.get());
+
+    decodeFirstCore = std::make_unique<ComboBox> ("decodeFirstCore");
+    decodeFirstCore->addItem ("Any core", 1);
+    for (int core = 0; core < numCpus; core++)
+        decodeFirstCore->addItem ("From core " + String (core), core + 2);
+    decodeFirstCore->setBounds (765, 40, 120, 25);
+    decodeFirstCore->setTooltip ("Pin the decode threads to consecutive cores starting here");
+    decodeFirstCore->addListener (this);
+    addAndMakeVisible (decodeFirstCore.get());
+
     gains.clear();
     gains.add (0.01);
     gains.add (0.1);
@@ -83,6 +156,10 @@ ChannelList::ChannelList (DeviceThread* board_, DeviceEditor* editor_) : board (
 void ChannelList::lookAndFeelChanged()
 {
     numberingSchemeLabel->setColour (Label::textColourId, findColour (ThemeColours::defaultText));
+    impedanceFrequenciesLabel->setColour (Label::textColourId, findColour (ThemeColours::defaultText));
+    impedanceFrequencies->setColour (Label::textColourId, findColour (ThemeColours::defaultText));
+    rawFramesLabel->setColour (Label::textColourId, findColour (ThemeColours::defaultText));
+    decodeThreadsLabel->setColour (Label::textColourId, findColour (ThemeColours::defaultText));
 
     update();
 }
@@ -107,6 +184,34 @@ void ChannelList::buttonClicked (Button* btn)
             editor->saveImpedance (impedenceFile);
         }
     }
+    else if (btn == adaptiveRangesButton.get())
+    {
+        board->setAdaptiveImpedanceRanges (btn->getToggleState());
+    }
+    else if (btn == rawFramesButton.get())
+    {
+        String directory;
+
+        if (btn->getToggleState())
+        {
+            FileChooser chooseDirectory ("Select a directory for the raw frame files...",
+                                         File (board->getRawFrameDirectory()));
+
+            if (chooseDirectory.browseForDirectory())
+                directory = chooseDirectory.getResult().getFullPathName();
+        }
+
+        board->setRawFrameDirectory (directory);
+
+        rawFramesButton->setToggleState (directory.isNotEmpty(), dontSendNotification);
+        rawFramesLabel->setText (directory, dontSendNotification);
+    }
+    else if (btn == streamPerHeadstageButton.get())
+    {
+        board->setStreamPerHeadstage (btn->getToggleState());
+
+        CoreServices::updateSignalChain (editor);
+    }
 }
 
 void ChannelList::update()
@@ -119,6 +224,7 @@ void ChannelList::update()
 
     staticLabels.clear();
     channelComponents.clear();
+    componentHeadstages.clear();
     impedanceButton->setEnabled (true);
 
     const int columnWidth = 250;
@@ -130,6 +236,19 @@ void ChannelList::update()
     maxChannels = 0;
 
     numberingScheme->setSelectedId (board->getNamingScheme(), dontSendNotification);
+    adaptiveRangesButton->setToggleState (board->getAdaptiveImpedanceRanges(), dontSendNotification);
+    adaptiveRangesButton->setEnabled (true);
+    impedanceFrequencies->setEnabled (true);
+    updateImpedanceFrequencies();
+    streamPerHeadstageButton->setToggleState (board->getStreamPerHeadstage(), dontSendNotification);
+    streamPerHeadstageButton->setEnabled (! board->isAcquisitionActive());
+    rawFramesButton->setToggleState (board->getRawFrameDirectory().isNotEmpty(), dontSendNotification);
+    rawFramesButton->setEnabled (! board->isAcquisitionActive());
+    rawFramesLabel->setText (board->getRawFrameDirectory(), dontSendNotification);
+    decodeThreads->setSelectedId (board->getDecodeThreads() + 1, dontSendNotification);
+    decodeThreads->setEnabled (! board->isAcquisitionActive());
+    decodeFirstCore->setSelectedId (board->getDecodeFirstCore() + 2, dontSendNotification);
+    decodeFirstCore->setEnabled (board->getDecodeThreads() > 0 && ! board->isAcquisitionActive());
 
     for (auto hs : headstages)
     {
@@ -139,7 +258,7 @@ void ChannelList::update()
 
         Label* lbl = new Label (hs->getStreamPrefix(), hs->getStreamPrefix());
         lbl->setEditable (false);
-        lbl->setBounds (10 + column * columnWidth, 40, columnWidth, 25);
+        lbl->setBounds (10 + column * columnWidth, 70, columnWidth, 25);
         lbl->setJustificationType (juce::Justification::centred);
         lbl->setColour (Label::textColourId, juce::Colours::white);
         staticLabels.add (lbl);
@@ -156,7 +275,7 @@ void ChannelList::update()
                     gains,
                     ContinuousChannel::ELECTRODE);
 
-            comp->setBounds (10 + column * columnWidth, 70 + ch * 22, columnWidth, 22);
+            comp->setBounds (10 + column * columnWidth, 100 + ch * 22, columnWidth, 22);
 
             if (hs->hasImpedanceData())
             {
@@ -164,8 +283,14 @@ void ChannelList::update()
                     hs->getImpedanceMagnitude (ch),
                     hs->getImpedancePhase (ch));
             }
+            // headstages are numbered by the data source they are plugged into (A1 = 0, A2 = 1, ...)
+            int hsNum = hs->getDataStream (0) / 2;
+            comp->setChannelEnabled (board->isChannelEnabled (hsNum, ch));
+            comp->setToggleEnabled (! board->isAcquisitionActive());
+
             //comp->setUserDefinedData(k);
             channelComponents.add (comp);
+            componentHeadstages.add (hsNum);
             addAndMakeVisible (comp);
         }
     }
@@ -185,14 +310,44 @@ void ChannelList::disableAll()
 {
     impedanceButton->setEnabled (false);
     saveImpedanceButton->setEnabled (false);
+    adaptiveRangesButton->setEnabled (false);
+    impedanceFrequencies->setEnabled (false);
     numberingScheme->setEnabled (false);
+    streamPerHeadstageButton->setEnabled (false);
+    rawFramesButton->setEnabled (false);
+    decodeThreads->setEnabled (false);
+    decodeFirstCore->setEnabled (false);
+
+    for (auto comp : channelComponents)
+        comp->setToggleEnabled (false);
 }
 
 void ChannelList::enableAll()
 {
     impedanceButton->setEnabled (true);
     saveImpedanceButton->setEnabled (true);
+    adaptiveRangesButton->setEnabled (true);
+    impedanceFrequencies->setEnabled (true);
     numberingScheme->setEnabled (true);
+    streamPerHeadstageButton->setEnabled (true);
+    rawFramesButton->setEnabled (true);
+    decodeThreads->setEnabled (true);
+    decodeFirstCore->setEnabled (board->getDecodeThreads() > 0);
+
+    for (auto comp : channelComponents)
+        comp->setToggleEnabled (true);
+}
+
+void ChannelList::channelEnabledChanged (ChannelComponent* component, bool enabled)
+{
+    int index = channelComponents.indexOf (component);
+
+    if (index < 0 || board->isAcquisitionActive())
+        return;
+
+    board->setChannelEnabled (componentHeadstages[index], component->getChannel(), enabled);
+
+    CoreServices::updateSignalChain (editor);
 }
 
 void ChannelList::comboBoxChanged (ComboBox* b)
@@ -203,4 +358,52 @@ void ChannelList::comboBoxChanged (ComboBox* b)
 
         CoreServices::updateSignalChain (editor);
     }
+    else if (b == decodeThreads.get())
+    {
+        board->setDecodeThreads (b->getSelectedId() - 1);
+        decodeFirstCore->setEnabled (board->getDecodeThreads() > 0);
+    }
+    else if (b == decodeFirstCore.get())
+    {
+        board->setDecodeFirstCore (b->getSelectedId() - 2);
+    }
+}
+
+void ChannelList::labelTextChanged (Label* label)
+{
+    if (label == impedanceFrequencies.get())
+    {
+        Array<float> frequencies;
+
+        for (auto token : StringArray::fromTokens (label->getText(), ",", ""))
+        {
+            if (token.trim().isEmpty())
+                continue;
+
+            const float frequency = token.getFloatValue();
+
+            if (frequency <= 0.0f)
+            {
+                CoreServices::sendStatusMessage ("Impedance test frequencies must be positive.");
+                updateImpedanceFrequencies();
+                return;
+            }
+
+            frequencies.add (frequency);
+        }
+
+        board->setImpedanceFrequencies (frequencies);
+        updateImpedanceFrequencies();
+    }
+}
+
+void ChannelList::updateImpedanceFrequencies()
+{
+    StringArray frequencies;
+
+    for (float frequency : board->getImpedanceFrequencies())
+        frequencies.add (String (frequency));
+
+    // an empty list measures at 1 kHz
+    impedanceFrequencies->setText (frequencies.isEmpty() ? "1000" : frequencies.joinIntoString (", "), dontSendNotification);
 }
@@ -35,7 +35,8 @@ class ChannelComponent;
 
 class ChannelList : public Component,
                     public Button::Listener,
-                    public ComboBox::Listener
+                    public ComboBox::Listener,
+                    public Label::Listener
 {
 public:
     /** Constructor */
@@ -60,6 +61,12 @@ public:
     /** ComboBox callback */
     void comboBoxChanged (ComboBox* b) override;
 
+    /** Label callback */
+    void labelTextChanged (Label* label) override;
+
+    /** Called when a channel's enable toggle is clicked */
+    void channelEnabledChanged (ChannelComponent* component, bool enabled);
+
     /** Updates layout of channel list */
     void update();
 
@@ -77,15 +84,32 @@ private:
 
     std::unique_ptr<UtilityButton> impedanceButton;
     std::unique_ptr<UtilityButton> saveImpedanceButton;
+    std::unique_ptr<UtilityButton> adaptiveRangesButton;
+    std::unique_ptr<Label> impedanceFrequenciesLabel;
+    std::unique_ptr<Label> impedanceFrequencies;
 
     std::unique_ptr<ComboBox> numberingScheme;
     std::unique_ptr<Label> numberingSchemeLabel;
 
+    std::unique_ptr<UtilityButton> streamPerHeadstageButton;
+    std::unique_ptr<UtilityButton> rawFramesButton;
+    std::unique_ptr<Label> rawFramesLabel;
+
+    std::unique_ptr<Label> decodeThreadsLabel;
+    std::unique_ptr<ComboBox> decodeThreads;
+    std::unique_ptr<ComboBox> decodeFirstCore;
+
     OwnedArray<Label> staticLabels;
     OwnedArray<ChannelComponent> channelComponents;
 
+    /** Index (in the board's headstage list) of each channel component's headstage */
+    Array<int> componentHeadstages;
+
     int maxChannels;
 
+    /** Shows the board's impedance test frequencies as a comma-separated list */
+    void updateImpedanceFrequencies();
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ChannelList);
 };
 
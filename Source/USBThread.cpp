@@ -21,7 +21,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "USBThread.h"
+#include "RawFrameRecorder.h"
 #include "rhythm-api/rhd2000evalboardusb3.h"
+#include "rhythm-api/rhd2000datablockusb3.h"
+
+#include <chrono>
+#include <thread>
 
 using namespace RhythmNode;
 
@@ -34,17 +39,58 @@ USBThread::~USBThread()
 {
 }
 
-void USBThread::startAcquisition (int nBytes)
+void USBThread::setNumBuffers (int numBuffers)
+{
+    if (! isThreadRunning())
+        m_numBuffers = jmax (2, numBuffers);
+}
+
+void USBThread::setAdaptiveTransfers (bool adaptive, unsigned int targetLatencyWords)
 {
-    ScopedLock lock (m_lock);
-    for (int i = 0; i < 2; i++)
+    if (! isThreadRunning())
     {
-        m_lastRead[i] = 0;
-        m_buffers[i].malloc (nBytes);
+        m_adaptive = adaptive;
+        m_targetLatencyWords = targetLatencyWords;
     }
-    m_curBuffer = 0;
-    m_readBuffer = 0;
-    m_canRead = true;
+}
+
+void USBThread::setSubBlockTransfers (int transferBytes)
+{
+    if (! isThreadRunning())
+        m_subBlockBytes = jmax (0, transferBytes);
+}
+
+void USBThread::setRecorder (RawFrameRecorder* recorder)
+{
+    if (! isThreadRunning())
+        m_recorder = recorder;
+}
+
+void USBThread::setBoardSampleRate (float sampleRate)
+{
+    m_sampleRate = sampleRate;
+}
+
+void USBThread::startAcquisition (int blockBytes, int blocksPerRead)
+{
+    m_blocksPerRead = jmax (1, blocksPerRead);
+    m_blockBytes = blockBytes;
+    m_bufferSize = m_subBlockBytes > 0 ? m_subBlockBytes : blockBytes * m_blocksPerRead;
+    m_buffers.malloc ((size_t) m_numBuffers * m_bufferSize);
+    m_lastRead.calloc (m_numBuffers);
+    m_arrivalTicks.calloc (m_numBuffers);
+
+    m_writeCount = 0;
+    m_readCount = 0;
+    m_holdingBuffer = false;
+    m_highWaterMark = 0;
+    m_producerStalls = 0;
+    m_currentBlocksPerRead = m_adaptive ? 1 : m_blocksPerRead;
+    m_numTransfers = 0;
+    m_numBlocksTransferred = 0;
+    m_wordsPerSecond = m_sampleRate * blockBytes / 2 / SAMPLES_PER_DATA_BLOCK;
+    m_board->resetFifoPollCounters();
+
     startThread();
 }
 
@@ -58,47 +104,129 @@ void USBThread::stopAcquisition()
             std::cerr << "USB Thread could not stop cleanly. Force quitting it" << std::endl;
         }
     }
+
+    LOGC ("USB ring high-water mark: ", getHighWaterMark(), " of ", m_numBuffers, " buffers, producer stalls: ", getProducerStalls());
+
+    LOGC ("USB FIFO polls: ", (int64) m_board->getNumFifoPolls(),
+          ", skipped: ", (int64) m_board->getNumFifoPollsSkipped(),
+          ", wasted (too little data): ", (int64) m_board->getNumWastedFifoPolls());
+
+    if (m_adaptive && m_numTransfers > 0)
+        LOGC ("Adaptive USB transfers: ", m_numTransfers, " transfers, ", (double) m_numBlocksTransferred / m_numTransfers, " blocks per transfer on average");
 }
 
 long USBThread::usbRead (unsigned char*& buffer)
 {
-    ScopedLock lock (m_lock);
-    if (m_readBuffer == m_curBuffer)
+    uint64 readCount = m_readCount.load (std::memory_order_relaxed);
+
+    // the buffer returned by the previous call has been consumed; hand it back to the reader
+    if (m_holdingBuffer)
+    {
+        m_readCount.store (++readCount, std::memory_order_release);
+        m_holdingBuffer = false;
+    }
+
+    if (m_writeCount.load (std::memory_order_acquire) == readCount)
         return 0;
-    buffer = m_buffers[m_readBuffer].getData();
-    long read = m_lastRead[m_readBuffer];
-    m_readBuffer = ++m_readBuffer % 2;
-    m_canRead = true;
-    notify();
-    return read;
+
+    int slot = (int) (readCount % (uint64) m_numBuffers);
+    buffer = m_buffers.getData() + (size_t) slot * m_bufferSize;
+    m_holdingBuffer = true;
+
+    return m_lastRead[slot];
 }
 
 void USBThread::run()
 {
+    bool stalled = false;
+
     while (! threadShouldExit())
     {
-        m_lock.enter();
-        if (m_canRead)
+        uint64 writeCount = m_writeCount.load (std::memory_order_relaxed);
+
+        if (writeCount - m_readCount.load (std::memory_order_acquire) >= (uint64) m_numBuffers)
         {
-            m_lock.exit();
-            long read;
-            do
+            // ring is full: count one stall per episode and give the decoder time to catch up
+            if (! stalled)
             {
-                if (threadShouldExit())
-                    break;
-                read = m_board->readDataBlocksRaw (1, m_buffers[m_curBuffer].getData());
-            } while (read <= 0);
-            {
-                ScopedLock lock (m_lock);
-                m_lastRead[m_curBuffer] = read;
-                m_curBuffer = ++m_curBuffer % 2;
-                m_canRead = false;
+                stalled = true;
+                ++m_producerStalls;
             }
+            wait (1);
+            continue;
+        }
+
+        stalled = false;
+
+        int slot = (int) (writeCount % (uint64) m_numBuffers);
+        unsigned char* buffer = m_buffers.getData() + (size_t) slot * m_bufferSize;
+
+        int numBlocks = m_currentBlocksPerRead.load (std::memory_order_relaxed);
+
+        unsigned int wordsToRead = (m_subBlockBytes > 0 ? m_subBlockBytes : numBlocks * m_blockBytes) / 2;
+
+        long read;
+        while (true)
+        {
+            if (threadShouldExit())
+                return;
+            if (m_subBlockBytes > 0)
+                read = m_board->readDataRaw (m_subBlockBytes, buffer);
+            else
+                read = m_board->readDataBlocksRaw (numBlocks, buffer);
+
+            if (read > 0)
+                break;
+
+            waitForData (wordsToRead);
         }
-        else
-            m_lock.exit();
 
-        if (! threadShouldExit())
-            wait (100);
+        m_arrivalTicks[slot] = Time::getHighResolutionTicks();
+
+        // saved before the decoder sees it, so the file is complete even if decoding falls behind
+        if (m_recorder != nullptr)
+            m_recorder->write (buffer, (size_t) read);
+
+        m_lastRead[slot] = read;
+        m_writeCount.store (++writeCount, std::memory_order_release);
+
+        ++m_numTransfers;
+        m_numBlocksTransferred += numBlocks;
+
+        if (m_adaptive)
+            m_currentBlocksPerRead.store (nextTransferSize (numBlocks), std::memory_order_relaxed);
+
+        int fill = (int) (writeCount - m_readCount.load (std::memory_order_acquire));
+        if (fill > m_highWaterMark.load (std::memory_order_relaxed))
+            m_highWaterMark.store (fill, std::memory_order_relaxed);
     }
 }
+
+int USBThread::nextTransferSize (int numBlocks) const
+{
+    // lower bound on the words still waiting after the last read
+    unsigned int backlogWords = m_board->getFifoWordsEstimate();
+
+    // data is piling up beyond the target: read all complete blocks already waiting
+    if (backlogWords > m_targetLatencyWords)
+        return jlimit (1, m_blocksPerRead, (int) (backlogWords / (m_blockBytes / 2)));
+
+    // caught up: shrink gradually toward single-block reads
+    return jmax (1, numBlocks / 2);
+}
+
+void USBThread::waitForData (unsigned int wordsToRead)
+{
+    // the failed read just polled the FIFO, so the estimate is its current level
+    unsigned int available = m_board->getFifoWordsEstimate();
+    unsigned int missingWords = wordsToRead > available ? wordsToRead - available : wordsToRead;
+
+    // sleep for about as long as the board needs to produce the missing words, instead of
+    // spinning on FIFO polls; never so long that a late wake-up adds noticeable latency
+    double seconds = m_wordsPerSecond > 0 ? missingWords / m_wordsPerSecond : 0.001;
+
+    if (seconds < 0.0001)
+        Thread::yield();
+    else
+        std::this_thread::sleep_for (std::chrono::microseconds ((int64) (jmin (seconds, 0.002) * 1.0e6)));
+}
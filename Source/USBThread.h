@@ -32,24 +32,110 @@ class Rhd2000EvalBoardUsb3;
 namespace RhythmNode
 {
 
+class RawFrameRecorder;
+
+/**
+        Reads raw data from the board's USB pipe on its own thread
+
+        Transfers are written into a ring of pre-allocated buffers that is
+        handed to the DeviceThread without locking (single producer, single
+        consumer), so a late decoder only costs ring depth instead of
+        stalling the USB reads.
+
+        In adaptive mode the number of blocks per transfer follows the
+        board's FIFO backlog: single blocks while the FIFO is nearly empty
+        (lowest latency), growing up to the configured maximum when data
+        accumulates beyond the target latency (highest throughput).
+
+        In sub-block mode every transfer is a fixed number of bytes smaller
+        than a data block, so samples may straddle two transfers.
+    */
 class USBThread : Thread
 {
 public:
     USBThread (Rhd2000EvalBoardUsb3*);
     ~USBThread();
     void run() override;
-    void startAcquisition (int nBytes);
+    /** Starts reading; blocksPerRead is the transfer size, or the maximum transfer size in adaptive mode */
+    void startAcquisition (int blockBytes, int blocksPerRead);
     void stopAcquisition();
+
+    /** Sets the board sample rate, used to pace retries while the FIFO fills up */
+    void setBoardSampleRate (float sampleRate);
+
+    /** Enables transfers sized from the FIFO backlog (applied on the next start).
+        targetLatencyWords is the backlog above which transfers grow to drain the FIFO */
+    void setAdaptiveTransfers (bool adaptive, unsigned int targetLatencyWords);
+
+    /** Reads fixed transfers of transferBytes (a multiple of USB3_BLOCK_SIZE) regardless of
+        block and sample boundaries; 0 reads whole data blocks (applied on the next start) */
+    void setSubBlockTransfers (int transferBytes);
+
+    /** Copies every transfer to a raw frame file as soon as it is read (nullptr = none);
+        applied on the next start */
+    void setRecorder (RawFrameRecorder* recorder);
+
+    /** Returns the size of the largest transfer, in bytes */
+    int getMaxTransferBytes() const { return m_bufferSize; }
+
+    /** Returns the next filled buffer, or 0 if none is ready.
+        The buffer stays valid until the next call to usbRead */
     long usbRead (unsigned char*&);
 
+    /** Returns when the transfer returned by the last usbRead() finished reading from USB,
+        in Time::getHighResolutionTicks() units */
+    int64 getArrivalTicks() const { return m_arrivalTicks[m_readCount.load (std::memory_order_relaxed) % (uint64) m_numBuffers]; }
+
+    /** Sets the number of transfer buffers in the ring (applied on the next start) */
+    void setNumBuffers (int numBuffers);
+
+    /** Returns the number of transfer buffers in the ring */
+    int getNumBuffers() const { return m_numBuffers; }
+
+    /** Returns the highest number of filled buffers waiting to be decoded since the last start */
+    int getHighWaterMark() const { return m_highWaterMark.load(); }
+
+    /** Returns the number of times the ring was full and the USB reads had to wait */
+    int64 getProducerStalls() const { return m_producerStalls.load(); }
+
+    /** Returns the number of blocks requested by the most recent transfer */
+    int getCurrentBlocksPerRead() const { return m_currentBlocksPerRead.load(); }
+
 private:
+    /** Chooses the number of blocks for the next adaptive transfer from the FIFO backlog */
+    int nextTransferSize (int numBlocks) const;
+
+    /** Waits until the FIFO should hold wordsToRead words, after a read found too little data */
+    void waitForData (unsigned int wordsToRead);
+
     Rhd2000EvalBoardUsb3* const m_board;
-    HeapBlock<unsigned char> m_buffers[2];
-    long m_lastRead[2];
-    unsigned short m_curBuffer { 0 };
-    unsigned short m_readBuffer { 0 };
-    bool m_canRead { false };
-    CriticalSection m_lock;
+
+    HeapBlock<unsigned char> m_buffers;
+    HeapBlock<long> m_lastRead;
+    HeapBlock<int64> m_arrivalTicks;
+    int m_bufferSize { 0 };
+    int m_blockBytes { 0 };
+    int m_blocksPerRead { 1 };
+    int m_numBuffers { 8 };
+
+    bool m_adaptive { false };
+    unsigned int m_targetLatencyWords { 0 };
+    int m_subBlockBytes { 0 };
+    RawFrameRecorder* m_recorder { nullptr };
+    float m_sampleRate { 30000.0f };
+    double m_wordsPerSecond { 0 };
+    std::atomic<int> m_currentBlocksPerRead { 1 };
+    int64 m_numTransfers { 0 };
+    int64 m_numBlocksTransferred { 0 };
+
+    /** Monotonic counts of buffers written and released; their difference is the fill level.
+        64 bits so they never wrap: slot = count % m_numBuffers needs that for depths that are not powers of two */
+    std::atomic<uint64> m_writeCount { 0 };
+    std::atomic<uint64> m_readCount { 0 };
+    bool m_holdingBuffer { false };
+
+    std::atomic<int> m_highWaterMark { 0 };
+    std::atomic<int64> m_producerStalls { 0 };
 };
 
 } // namespace RhythmNode
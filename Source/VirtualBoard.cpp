@@ -0,0 +1,291 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "VirtualBoard.h"
+#include "rhythm-api/rhd2000datablockusb3.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+using namespace RhythmNode;
+
+/** Upper bound on the frames generated in one go, to keep the pending buffer small */
+static const int64_t maxFramesPerGenerate = 4096;
+
+VirtualBoard::VirtualBoard (bool realTime_)
+    : realTime (realTime_)
+{
+}
+
+VirtualBoard::~VirtualBoard()
+{
+}
+
+void VirtualBoard::initialize()
+{
+    resetBoard();
+    setSampleRate (SampleRate30000Hz);
+    setContinuousRunMode (true);
+    setMaxTimeStep (4294967295);
+
+    for (int i = 0; i < MAX_NUM_SPI_PORTS; i++)
+        setCableDelay ((BoardPort) i, 0);
+
+    enableDataStream (0, true);
+
+    for (int i = 1; i < MAX_NUM_DATA_STREAMS; i++)
+        enableDataStream (i, false);
+
+    clearTtlOut();
+}
+
+bool VirtualBoard::setSampleRate (AmplifierSampleRate newSampleRate)
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    sampleRate = newSampleRate;
+    return true;
+}
+
+void VirtualBoard::resetBoard()
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    running = false;
+    runFrames = 0;
+    pendingOffset = pendingBytes;
+    fifoWordsEstimate = 0;
+}
+
+void VirtualBoard::resetFpga()
+{
+    resetBoard();
+}
+
+void VirtualBoard::setContinuousRunMode (bool continuousMode)
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    // leaving continuous mode stops the run at maxTimeStep, or straight away if that has passed
+    if (running && continuous && ! continuousMode)
+        runFrames = std::max ((int64_t) maxTimeStep, getFramesAcquired());
+
+    continuous = continuousMode;
+}
+
+void VirtualBoard::setMaxTimeStep (unsigned int newMaxTimeStep)
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    if (running && ! continuous)
+        runFrames = std::max ((int64_t) newMaxTimeStep, getFramesAcquired());
+
+    maxTimeStep = newMaxTimeStep;
+}
+
+void VirtualBoard::run()
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    frameWords = (int) Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords (numDataStreams, 1);
+    runFrames = continuous ? std::numeric_limits<int64_t>::max() : (int64_t) maxTimeStep;
+    framesGenerated = 0;
+    bytesRead = 0;
+    pendingBytes = 0;
+    pendingOffset = 0;
+    fifoWordsEstimate = 0;
+
+    startRun();
+
+    running = true;
+    runStart = std::chrono::steady_clock::now();
+}
+
+bool VirtualBoard::isRunning()
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    return running && getFramesAcquired() < runFrames;
+}
+
+int64_t VirtualBoard::getFramesAcquired() const
+{
+    if (! running || frameWords == 0)
+        return 0;
+
+    int64_t frames = runFrames;
+
+    if (realTime)
+    {
+        const double elapsed = std::chrono::duration<double> (std::chrono::steady_clock::now() - runStart).count();
+        frames = std::min (frames, (int64_t) (elapsed * getSampleRate()));
+    }
+    else
+    {
+        // keep the FIFO full: everything read so far plus a FIFO's worth
+        frames = std::min (frames, bytesRead / (2 * frameWords) + FIFO_CAPACITY_WORDS / frameWords);
+    }
+
+    const int64_t framesLeft = getNumFramesLeft();
+
+    if (framesLeft >= 0)
+        frames = std::min (frames, framesGenerated + framesLeft);
+
+    return frames;
+}
+
+unsigned int VirtualBoard::numWordsInFifo()
+{
+    int64_t words = getFramesAcquired() * frameWords - bytesRead / 2;
+    words = std::max ((int64_t) 0, std::min (words, (int64_t) FIFO_CAPACITY_WORDS));
+
+    lastNumWordsInFifo = (unsigned int) words;
+    numWordsHasBeenUpdated = true;
+    fifoWordsEstimate = lastNumWordsInFifo;
+    return lastNumWordsInFifo;
+}
+
+bool VirtualBoard::generatePending (int64_t bytesWanted)
+{
+    if (frameWords == 0)
+        return false;
+
+    const int64_t frameBytes = 2 * (int64_t) frameWords;
+    const int numFrames = (int) std::max ((int64_t) 1, std::min (maxFramesPerGenerate, (bytesWanted + frameBytes - 1) / frameBytes));
+
+    if (pending.size() < (size_t) numFrames * frameWords)
+        pending.resize ((size_t) numFrames * frameWords);
+
+    const int numGenerated = generateFrames (pending.data(), framesGenerated, numFrames);
+
+    framesGenerated += numGenerated;
+    pendingBytes = (size_t) numGenerated * frameBytes;
+    pendingOffset = 0;
+
+    return numGenerated > 0;
+}
+
+long VirtualBoard::readFromPipe (long numBytes, unsigned char* buffer)
+{
+    long copied = 0;
+
+    while (copied < numBytes)
+    {
+        if (pendingOffset == pendingBytes && ! generatePending (numBytes - copied))
+            break;
+
+        const size_t numToCopy = std::min (pendingBytes - pendingOffset, (size_t) (numBytes - copied));
+        memcpy (buffer + copied, reinterpret_cast<const unsigned char*> (pending.data()) + pendingOffset, numToCopy);
+
+        pendingOffset += numToCopy;
+        copied += (long) numToCopy;
+    }
+
+    // a source that has run out reads as zeros, like an underflowing FIFO
+    if (copied < numBytes)
+        memset (buffer + copied, 0, (size_t) (numBytes - copied));
+
+    bytesRead += numBytes;
+
+    return numBytes;
+}
+
+void VirtualBoard::flush()
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    const int64_t frameBytes = 2 * (int64_t) frameWords;
+    const int64_t framesAcquired = getFramesAcquired();
+
+    // pending frames were already taken from the source; anything acquired beyond them is skipped there
+    if (framesAcquired > framesGenerated)
+    {
+        skipFrames (framesAcquired - framesGenerated);
+        framesGenerated = framesAcquired;
+    }
+
+    bytesRead = std::max (bytesRead, framesGenerated * frameBytes);
+    pendingOffset = pendingBytes;
+    fifoWordsEstimate = 0;
+}
+
+void VirtualBoard::setCableDelay (BoardPort port, int delay)
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    if (port >= 0 && port < MAX_NUM_SPI_PORTS)
+        cableDelay[port] = std::max (0, std::min (delay, 15));
+}
+
+void VirtualBoard::enableDataStream (int stream, bool enabled)
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    if (stream < 0 || stream >= MAX_NUM_DATA_STREAMS)
+        return;
+
+    if (enabled && dataStreamEnabled[stream] == 0)
+    {
+        dataStreamEnabled[stream] = 1;
+        numDataStreams++;
+    }
+    else if (! enabled && dataStreamEnabled[stream] == 1)
+    {
+        dataStreamEnabled[stream] = 0;
+        numDataStreams--;
+    }
+}
+
+void VirtualBoard::clearTtlOut()
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    ttlOutWord = 0;
+}
+
+void VirtualBoard::setTtlOut (int ttlOutArray[])
+{
+    std::lock_guard<std::mutex> lockOk (okMutex);
+
+    uint16_t word = 0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        if (ttlOutArray[i] > 0)
+            word |= (uint16_t) (1 << i);
+    }
+
+    ttlOutWord = word;
+}
+
+void VirtualBoard::getTtlIn (int ttlInArray[])
+{
+    for (int i = 0; i < 16; i++)
+        ttlInArray[i] = 0;
+}
+
+int VirtualBoard::readDigitalInManual (bool& expanderBoardDetected)
+{
+    expanderBoardDetected = false;
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2024 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VIRTUALBOARD_H
+#define VIRTUALBOARD_H
+
+#include "rhythm-api/rhd2000evalboardusb3.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace RhythmNode
+{
+
+/**
+        Rhythm board without an Opal Kelly module behind it
+
+        Keeps the bookkeeping the real board does on the host side (enabled
+        streams, sample rate, cable delays, run mode) and models the USB FIFO:
+        after run(), frames "arrive" at the sample rate (or as fast as they
+        are read, when not in real time) and are produced on demand by
+        generateFrames(). The read and FIFO accounting code of
+        Rhd2000EvalBoardUsb3 runs unchanged on top, so the USBThread and
+        DeviceThread cannot tell the difference.
+
+        Every other device call is accepted and ignored. This file does not
+        depend on JUCE, so it can be built into standalone tools.
+    */
+class VirtualBoard : public Rhd2000EvalBoardUsb3
+{
+public:
+    /** If realTime is false, the FIFO is always full and frames are produced as fast as they are read */
+    explicit VirtualBoard (bool realTime);
+
+    ~VirtualBoard() override;
+
+    /** Returns true if frames are paced at the sample rate */
+    bool isRealTime() const { return realTime; }
+
+    OpalKellyBoardType open() override { return XEM7310; }
+    bool uploadFpgaBitfile (std::string) override { return true; }
+    void initialize() override;
+
+    bool setSampleRate (AmplifierSampleRate newSampleRate) override;
+
+    void uploadCommandList (const std::vector<int>&, AuxCmdSlot, int) override {}
+    void selectAuxCommandBank (BoardPort, AuxCmdSlot, int) override {}
+    void selectAuxCommandLength (AuxCmdSlot, int, int) override {}
+
+    void resetBoard() override;
+    void resetFpga() override;
+    void setContinuousRunMode (bool continuousMode) override;
+    void setMaxTimeStep (unsigned int maxTimeStep) override;
+    void run() override;
+    bool isRunning() override;
+
+    void setCableDelay (BoardPort port, int delay) override;
+    void setDspSettle (bool) override {}
+    void enableDataStream (int stream, bool enabled) override;
+
+    void clearTtlOut() override;
+    void setTtlOut (int ttlOutArray[]) override;
+    void getTtlIn (int ttlInArray[]) override;
+
+    void setDacManual (int) override {}
+    void setLedDisplay (int[]) override {}
+    void setSpiLedDisplay (int[]) override {}
+    void enableDac (int, bool) override {}
+    void setDacGain (int) override {}
+    void setAudioNoiseSuppress (int) override {}
+    void selectDacDataStream (int, int) override {}
+    void selectDacDataChannel (int, int) override {}
+    void enableExternalFastSettle (bool) override {}
+    void setExternalFastSettleChannel (int) override {}
+    void enableExternalDigOut (BoardPort, bool) override {}
+    void setExternalDigOutChannel (BoardPort, int) override {}
+    void enableDacHighpassFilter (bool) override {}
+    void setDacHighpassFilter (double) override {}
+    void setDacThreshold (int, int, bool) override {}
+    void setTtlMode (int) override {}
+
+    void flush() override;
+    int getBoardMode() override { return RHD_BOARD_MODE; }
+
+    int readDigitalInManual (bool& expanderBoardDetected) override;
+    void readDigitalInExpManual() override {}
+
+    void setDacRerefSource (int, int) override {}
+    void enableDacReref (bool) override {}
+
+protected:
+    unsigned int numWordsInFifo() override;
+    long readFromPipe (long numBytes, unsigned char* buffer) override;
+
+    /** Writes numFrames whole frames for the enabled streams to dest. firstFrame is
+        the index of the first one since run(), for the timestamps. Returns the number
+        of frames written; fewer than asked means the source has run out. */
+    virtual int generateFrames (uint16_t* dest, int64_t firstFrame, int numFrames) = 0;
+
+    /** Returns the number of frames the source can still produce, or -1 if it never runs out */
+    virtual int64_t getNumFramesLeft() const { return -1; }
+
+    /** Skips numFrames frames that were acquired but flushed unread; sources that
+        do not keep a position can ignore this */
+    virtual void skipFrames (int64_t numFrames) {}
+
+    /** Called from run(), before any frame is generated; okMutex is held */
+    virtual void startRun() {}
+
+    /** Returns the number of 16-bit words in one frame, fixed when run() is called */
+    int getFrameWords() const { return frameWords; }
+
+    /** Current TTL output word, as set by setTtlOut() */
+    uint16_t ttlOutWord = 0;
+
+private:
+    /** Returns the number of frames the board has acquired since run(); okMutex must be held */
+    int64_t getFramesAcquired() const;
+
+    /** Generates at least one more frame into the pending buffer; returns false if the source is exhausted */
+    bool generatePending (int64_t bytesWanted);
+
+    const bool realTime;
+
+    bool running = false;
+    bool continuous = true;
+    unsigned int maxTimeStep = 0;
+
+    /** Frames the current run stops after (INT64_MAX when continuous) */
+    int64_t runFrames = 0;
+
+    std::chrono::steady_clock::time_point runStart;
+
+    int frameWords = 0;
+
+    /** Frames generated and bytes handed out since run() */
+    int64_t framesGenerated = 0;
+    int64_t bytesRead = 0;
+
+    /** Generated frames not read yet (a read may end part way through a frame) */
+    std::vector<uint16_t> pending;
+    size_t pendingBytes = 0;
+    size_t pendingOffset = 0;
+};
+
+} // namespace RhythmNode
+
+#endif // VIRTUALBOARD_H
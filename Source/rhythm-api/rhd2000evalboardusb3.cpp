@@ -54,6 +54,8 @@ Rhd2000EvalBoardUsb3::Rhd2000EvalBoardUsb3()
     cableDelay.resize(MAX_NUM_SPI_PORTS, -1);
     lastNumWordsInFifo = 0;
     numWordsHasBeenUpdated = false;
+    fifoWordsEstimate = 0;
+    resetFifoPollCounters();
 }
 
 Rhd2000EvalBoardUsb3::~Rhd2000EvalBoardUsb3()
@@ -715,6 +717,8 @@ void Rhd2000EvalBoardUsb3::resetBoard()
     dev->SetWireInValue(WireInMultiUse, RAM_BURST_SIZE);
     dev->UpdateWireIns();
     dev->ActivateTriggerIn(TrigInConfig, 10);
+
+    fifoWordsEstimate = 0; // reset clears the FIFO
 }
 
 // Low-level FPGA reset.  Call when closing application to make sure everything has stopped.
@@ -723,6 +727,7 @@ void Rhd2000EvalBoardUsb3::resetFpga()
     lock_guard<mutex> lockOk(okMutex);
 
     dev->ResetFPGA();
+    fifoWordsEstimate = 0;
 }
 
 // Set the FPGA to run continuously once started (if continuousMode == true) or to run until
@@ -780,9 +785,48 @@ unsigned int Rhd2000EvalBoardUsb3::numWordsInFifo()
     dev->UpdateWireOuts();
     lastNumWordsInFifo = dev->GetWireOutValue(WireOutNumWords);
     numWordsHasBeenUpdated = true;
+    fifoWordsEstimate = lastNumWordsInFifo;
     return lastNumWordsInFifo;
 }
 
+// Reads numBytes bytes from the USB data pipe, in USB3_BLOCK_SIZE blocks.  (Protected method;
+// okMutex must be held.)
+long Rhd2000EvalBoardUsb3::readFromPipe(long numBytes, unsigned char* buffer)
+{
+    return dev->ReadFromBlockPipeOut(PipeOutData, USB3_BLOCK_SIZE, numBytes, buffer);
+}
+
+// Returns true if at least numWords 16-bit words are waiting in the USB FIFO.  The FIFO only fills
+// between reads, so the level measured at the last poll less the words read since then is a lower
+// bound on its contents; the WireOut round trip is only made when that bound is too small.
+// (Private method; okMutex must be held.)
+bool Rhd2000EvalBoardUsb3::fifoHasWords(unsigned int numWords)
+{
+    if (fifoWordsEstimate >= numWords) {
+        ++numFifoPollsSkipped;
+        return true;
+    }
+
+    ++numFifoPolls;
+    if (numWordsInFifo() >= numWords)
+        return true;
+
+    ++numWastedFifoPolls;
+    return false;
+}
+
+// Updates the local FIFO level estimate after a pipe read.  (Private method; okMutex must be held.)
+void Rhd2000EvalBoardUsb3::consumeFifoWords(long bytesRead)
+{
+    if (bytesRead < 0) {
+        fifoWordsEstimate = 0; // failed read: the FIFO level is unknown, so poll next time
+        return;
+    }
+
+    unsigned int wordsRead = (unsigned int) (bytesRead / 2);
+    fifoWordsEstimate = (fifoWordsEstimate > wordsRead) ? fifoWordsEstimate - wordsRead : 0;
+}
+
 // Returns the number of 16-bit words in the USB FIFO.  The user should never attempt to read
 // more data than the FIFO currently contains, as it is not protected against underflow.
 // (Public, threadsafe method.)
@@ -813,6 +857,39 @@ unsigned int Rhd2000EvalBoardUsb3::getLastNumWordsInFifo(bool& hasBeenUpdated)
     return lastNumWordsInFifo;
 }
 
+// Returns a lower bound on the number of 16-bit words in the USB FIFO: the level measured at the most
+// recent poll, less the words read since.  Does not access the USB port.
+unsigned int Rhd2000EvalBoardUsb3::getFifoWordsEstimate() const
+{
+    return fifoWordsEstimate;
+}
+
+// Resets the counters of FIFO level polls made, skipped, and wasted by the data read methods.
+void Rhd2000EvalBoardUsb3::resetFifoPollCounters()
+{
+    numFifoPolls = 0;
+    numFifoPollsSkipped = 0;
+    numWastedFifoPolls = 0;
+}
+
+// Returns the number of FIFO level polls (WireOut round trips) made by the data read methods.
+unsigned long long Rhd2000EvalBoardUsb3::getNumFifoPolls() const
+{
+    return numFifoPolls;
+}
+
+// Returns the number of reads that went ahead on the local FIFO level estimate without polling.
+unsigned long long Rhd2000EvalBoardUsb3::getNumFifoPollsSkipped() const
+{
+    return numFifoPollsSkipped;
+}
+
+// Returns the number of FIFO level polls that found too little data to read.
+unsigned long long Rhd2000EvalBoardUsb3::getNumWastedFifoPolls() const
+{
+    return numWastedFifoPolls;
+}
+
 // Returns the number of 16-bit words the USB SDRAM FIFO can hold.  The FIFO can actually hold a few
 // thousand words more than the number returned by this method due to FPGA "mini-FIFOs" interfacing
 // with the SDRAM, but this provides a conservative estimate of FIFO capacity.
@@ -1456,14 +1533,16 @@ void Rhd2000EvalBoardUsb3::flush()
     dev->UpdateWireIns();
 
     while (numWordsInFifo() >= usbBufferSize / 2) {
-        dev->ReadFromBlockPipeOut(PipeOutData, USB3_BLOCK_SIZE, usbBufferSize, usbBuffer);
+        readFromPipe(usbBufferSize, usbBuffer);
     }
     while (numWordsInFifo() > 0) {
-        dev->ReadFromBlockPipeOut(PipeOutData, USB3_BLOCK_SIZE, USB3_BLOCK_SIZE * max(2 * numWordsInFifo() / USB3_BLOCK_SIZE, (unsigned int)1), usbBuffer);
+        readFromPipe(USB3_BLOCK_SIZE * max(2 * numWordsInFifo() / USB3_BLOCK_SIZE, (unsigned int)1), usbBuffer);
     }
 
     dev->SetWireInValue(WireInResetRun, 0 << 16, 1 << 16);
     dev->UpdateWireIns();
+
+    fifoWordsEstimate = 0;
 }
 
 // Read data block from the USB interface, if one is available.  Returns true if data block
@@ -1483,8 +1562,9 @@ bool Rhd2000EvalBoardUsb3::readDataBlock(Rhd2000DataBlockUsb3 *dataBlock, int nS
         return false;
     }
 	//std::cout << " Reading " << nSamples << " samples " << numBytesToRead << " bytes with block size " << USB3_BLOCK_SIZE << std::endl;
-    result = dev->ReadFromBlockPipeOut(PipeOutData, USB3_BLOCK_SIZE, USB3_BLOCK_SIZE * max(numBytesToRead / USB3_BLOCK_SIZE, (unsigned int)1), usbBuffer);
+    result = readFromPipe(USB3_BLOCK_SIZE * max(numBytesToRead / USB3_BLOCK_SIZE, (unsigned int)1), usbBuffer);
 	//std::cout << "Read " << result << std::endl;
+    consumeFifoWords(result);
     if (result == ok_Failed) {
         cerr << "CRITICAL (readDataBlock): Failure on pipe read.  Check block and buffer sizes." << endl;
     } else if (result == ok_Timeout) {
@@ -1504,9 +1584,10 @@ long Rhd2000EvalBoardUsb3::readDataBlocksRaw(int numBlocks, unsigned char* buffe
 
     unsigned int numWordsToRead = numBlocks * Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords(numDataStreams, nSamples);
 
-    if (numWordsInFifo() < numWordsToRead)
+    if (!fifoHasWords(numWordsToRead))
 	   return 0;
-    long result = dev->ReadFromBlockPipeOut(PipeOutData, USB3_BLOCK_SIZE, 2 * numWordsToRead, buffer);
+    long result = readFromPipe(2 * numWordsToRead, buffer);
+    consumeFifoWords(result);
 
     if (result == ok_Failed) {
         cerr << "CRITICAL (readDataBlocksRaw): Failure on BT pipe read.  Check block and buffer sizes." << endl;
@@ -1517,6 +1598,33 @@ long Rhd2000EvalBoardUsb3::readDataBlocksRaw(int numBlocks, unsigned char* buffe
     return result;
 }
 
+// Reads a fixed number of bytes from the USB FIFO, if that many are available, without regard to
+// data block or sample boundaries.  numBytes must be a multiple of USB3_BLOCK_SIZE; the caller is
+// responsible for reassembling samples that straddle two reads.  Returns the number of bytes read,
+// or 0 if the FIFO did not hold enough data.
+long Rhd2000EvalBoardUsb3::readDataRaw(unsigned int numBytes, unsigned char* buffer)
+{
+    lock_guard<mutex> lockOk(okMutex);
+
+    if (numBytes == 0 || numBytes % USB3_BLOCK_SIZE != 0) {
+        cerr << "Error in Rhd2000EvalBoardUsb3::readDataRaw: numBytes must be a multiple of " << USB3_BLOCK_SIZE << "." << endl;
+        return 0;
+    }
+
+    if (!fifoHasWords(numBytes / 2))
+        return 0;
+    long result = readFromPipe(numBytes, buffer);
+    consumeFifoWords(result);
+
+    if (result == ok_Failed) {
+        cerr << "CRITICAL (readDataRaw): Failure on BT pipe read.  Check block and buffer sizes." << endl;
+    } else if (result == ok_Timeout) {
+        cerr << "CRITICAL (readDataRaw): Timeout on BT pipe read.  Check block and buffer sizes." << endl;
+    }
+
+    return result;
+}
+
 // Reads a certain number of USB data blocks, if the specified number is available, and appends them
 // to queue.  Returns true if data blocks were available.
 bool Rhd2000EvalBoardUsb3::readDataBlocks(int numBlocks, queue<Rhd2000DataBlockUsb3> &dataQueue)
@@ -1541,7 +1649,8 @@ bool Rhd2000EvalBoardUsb3::readDataBlocks(int numBlocks, queue<Rhd2000DataBlockU
         return false;
     }
 
-    result = dev->ReadFromBlockPipeOut(PipeOutData, USB3_BLOCK_SIZE, numBytesToRead, usbBuffer);
+    result = readFromPipe(numBytesToRead, usbBuffer);
+    consumeFifoWords(result);
 
     if (result == ok_Failed) {
         cerr << "CRITICAL (readDataBlocks): Failure on pipe read.  Check block and buffer sizes." << endl;
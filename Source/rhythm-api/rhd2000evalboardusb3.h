@@ -60,11 +60,11 @@ public:
     };
 
     Rhd2000EvalBoardUsb3();
-    ~Rhd2000EvalBoardUsb3();
+    virtual ~Rhd2000EvalBoardUsb3();
 
-    OpalKellyBoardType open();
-    bool uploadFpgaBitfile(std::string filename);
-    void initialize();
+    virtual OpalKellyBoardType open();
+    virtual bool uploadFpgaBitfile(std::string filename);
+    virtual void initialize();
 
     enum AmplifierSampleRate {
         SampleRate1000Hz,
@@ -86,7 +86,7 @@ public:
         SampleRate30000Hz
     };
 
-    bool setSampleRate(AmplifierSampleRate newSampleRate);
+    virtual bool setSampleRate(AmplifierSampleRate newSampleRate);
     double getSampleRate() const;
     AmplifierSampleRate getSampleRateEnum() const;
 
@@ -107,75 +107,87 @@ public:
         PortH
     };
 
-    void uploadCommandList(const std::vector<int> &commandList, AuxCmdSlot auxCommandSlot, int bank);
+    virtual void uploadCommandList(const std::vector<int> &commandList, AuxCmdSlot auxCommandSlot, int bank);
     void printCommandList(const std::vector<int> &commandList) const;
-    void selectAuxCommandBank(BoardPort port, AuxCmdSlot auxCommandSlot, int bank);
-    void selectAuxCommandLength(AuxCmdSlot auxCommandSlot, int loopIndex, int endIndex);
-
-    void resetBoard();
-    void resetFpga();
-    void setContinuousRunMode(bool continuousMode);
-    void setMaxTimeStep(unsigned int maxTimeStep);
-    void run();
-    bool isRunning();
+    virtual void selectAuxCommandBank(BoardPort port, AuxCmdSlot auxCommandSlot, int bank);
+    virtual void selectAuxCommandLength(AuxCmdSlot auxCommandSlot, int loopIndex, int endIndex);
+
+    virtual void resetBoard();
+    virtual void resetFpga();
+    virtual void setContinuousRunMode(bool continuousMode);
+    virtual void setMaxTimeStep(unsigned int maxTimeStep);
+    virtual void run();
+    virtual bool isRunning();
     unsigned int getNumWordsInFifo();
     unsigned int getLastNumWordsInFifo();
     unsigned int getLastNumWordsInFifo(bool& hasBeenUpdated);
+    unsigned int getFifoWordsEstimate() const;
     static unsigned int fifoCapacityInWords();
 
-    void setCableDelay(BoardPort port, int delay);
+    void resetFifoPollCounters();
+    unsigned long long getNumFifoPolls() const;
+    unsigned long long getNumFifoPollsSkipped() const;
+    unsigned long long getNumWastedFifoPolls() const;
+
+    virtual void setCableDelay(BoardPort port, int delay);
     void setCableLengthMeters(BoardPort port, double lengthInMeters);
     void setCableLengthFeet(BoardPort port, double lengthInFeet);
     double estimateCableLengthMeters(int delay) const;
     double estimateCableLengthFeet(int delay) const;
 
-    void setDspSettle(bool enabled);
+    virtual void setDspSettle(bool enabled);
     void setAllDacsToZero();
 
-    void enableDataStream(int stream, bool enabled);
+    virtual void enableDataStream(int stream, bool enabled);
     int getNumEnabledDataStreams() const;
 
-    void clearTtlOut();
-    void setTtlOut(int ttlOutArray[]);
-    void getTtlIn(int ttlInArray[]);
-
-    void setDacManual(int value);
-
-    void setLedDisplay(int ledArray[]);
-    void setSpiLedDisplay(int ledArray[]);
-
-    void enableDac(int dacChannel, bool enabled);
-    void setDacGain(int gain);
-    void setAudioNoiseSuppress(int noiseSuppress);
-    void selectDacDataStream(int dacChannel, int stream);
-    void selectDacDataChannel(int dacChannel, int dataChannel);
-    void enableExternalFastSettle(bool enable);
-    void setExternalFastSettleChannel(int channel);
-    void enableExternalDigOut(BoardPort port, bool enable);
-    void setExternalDigOutChannel(BoardPort port, int channel);
-    void enableDacHighpassFilter(bool enable);
-    void setDacHighpassFilter(double cutoff);
-    void setDacThreshold(int dacChannel, int threshold, bool trigPolarity);
-    void setTtlMode(int mode);
-
-    void flush();
+    virtual void clearTtlOut();
+    virtual void setTtlOut(int ttlOutArray[]);
+    virtual void getTtlIn(int ttlInArray[]);
+
+    virtual void setDacManual(int value);
+
+    virtual void setLedDisplay(int ledArray[]);
+    virtual void setSpiLedDisplay(int ledArray[]);
+
+    virtual void enableDac(int dacChannel, bool enabled);
+    virtual void setDacGain(int gain);
+    virtual void setAudioNoiseSuppress(int noiseSuppress);
+    virtual void selectDacDataStream(int dacChannel, int stream);
+    virtual void selectDacDataChannel(int dacChannel, int dataChannel);
+    virtual void enableExternalFastSettle(bool enable);
+    virtual void setExternalFastSettleChannel(int channel);
+    virtual void enableExternalDigOut(BoardPort port, bool enable);
+    virtual void setExternalDigOutChannel(BoardPort port, int channel);
+    virtual void enableDacHighpassFilter(bool enable);
+    virtual void setDacHighpassFilter(double cutoff);
+    virtual void setDacThreshold(int dacChannel, int threshold, bool trigPolarity);
+    virtual void setTtlMode(int mode);
+
+    virtual void flush();
     bool readDataBlock(Rhd2000DataBlockUsb3 *dataBlock, int nSamples = -1);
 	long readDataBlocksRaw(int numBlocks, unsigned char* buffer, int nSamples = -1);
+    long readDataRaw(unsigned int numBytes, unsigned char* buffer);
     bool readDataBlocks(int numBlocks, std::queue<Rhd2000DataBlockUsb3> &dataQueue);
     int queueToFile(std::queue<Rhd2000DataBlockUsb3> &dataQueue, std::ofstream &saveOut);
-    int getBoardMode();
+    virtual int getBoardMode();
     int getCableDelay(BoardPort port) const;
     void getCableDelay(std::vector<int> &delays) const;
 
-    int readDigitalInManual(bool& expanderBoardDetected);
-    void readDigitalInExpManual();
+    virtual int readDigitalInManual(bool& expanderBoardDetected);
+    virtual void readDigitalInExpManual();
 
-    void setDacRerefSource(int stream, int channel);
-    void enableDacReref(bool enabled);
+    virtual void setDacRerefSource(int stream, int channel);
+    virtual void enableDacReref(bool enabled);
 
 	bool getStreamEnabled(int stream) const;
 
-private:
+protected:
+    // Reads numBytes bytes from the USB data pipe into buffer.  Returns the number of bytes read or
+    // a negative Opal Kelly error code.  Subclasses that do not talk to an Opal Kelly module (replay
+    // and emulated boards) override this and numWordsInFifo(); the read methods above then run unchanged.
+    virtual long readFromPipe(long numBytes, unsigned char* buffer);
+
     OpalKellyLegacy::okCFrontPanel *dev;
     AmplifierSampleRate sampleRate;
     unsigned int usbBufferSize;
@@ -237,14 +249,22 @@ private:
         PipeOutData = 0xa0
     };
 
-    std::string opalKellyModelName(int model) const;
-
     bool isDcmProgDone() const;
     bool isDataClockLocked() const;
 
     unsigned int lastNumWordsInFifo;
     bool numWordsHasBeenUpdated;
-    unsigned int numWordsInFifo();
+    virtual unsigned int numWordsInFifo();
+
+    unsigned int fifoWordsEstimate;
+    unsigned long long numFifoPolls;
+    unsigned long long numFifoPollsSkipped;
+    unsigned long long numWastedFifoPolls;
+    bool fifoHasWords(unsigned int numWords);
+    void consumeFifoWords(long bytesRead);
+
+private:
+    std::string opalKellyModelName(int model) const;
 };
 
 #endif // RHD2000EVALBOARDUSB3_H